@@ -1,6 +1,8 @@
 #include "aparse.h"
 
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,19 +14,25 @@
 #define AP_ARG_FLAG_SUB 0x4         /* subparser argument */
 #define AP_ARG_FLAG_COALESCE 0x8    /* coalesce short opt in usage */
 #define AP_ARG_FLAG_DESTRUCTOR 0x10 /* arg callback has embedded dtor */
+#define AP_ARG_FLAG_BIT 0x20        /* bit flag: set `mask` in `*user` */
+#define AP_ARG_FLAG_AT 0x40         /* output is at `offset` from the base */
+#define AP_ARG_FLAG_NOVALUE 0x80    /* arg callback takes no value */
 
 typedef struct ap_arg ap_arg;
 
-/* internal argument structure */
+/* internal argument structure, with fields used while parsing first and
+ * fields only used for help text and definition last */
 struct ap_arg {
   int flags;            /* bitset of AP_ARG_FLAG_xxx */
-  ap_arg *next;         /* next argument in list */
+  char opt_short;       /* if short option, option character */
+  const char *opt_long; /* long opt */
   ap_cb cb;             /* callback */
+  void *user;           /* user pointer */
+  unsigned long mask;   /* bit flag mask (if AP_ARG_FLAG_BIT) */
+  size_t offset;        /* output offset from the base (if AP_ARG_FLAG_AT) */
+  ap_arg *next;         /* next argument in list */
   const char *metavar;  /* metavar */
   const char *help;     /* help text */
-  const char *opt_long; /* long opt */
-  char opt_short;       /* if short option, option character */
-  void *user;           /* user pointer */
   void *user1;          /* second user pointer (used for subparser) */
 };
 
@@ -32,10 +40,89 @@ struct ap_arg {
 typedef struct ap_sub ap_sub;
 struct ap_sub {
   const char *identifier; /* command name */
-  ap *par;                /* the subparser itself*/
+  ap *par;                /* the subparser itself (NULL if not yet built) */
+  ap_sub_builder builder; /* builds `par` on first use (NULL if eager) */
+  void *builder_user;     /* user pointer passed to `builder` */
+  ap_arg *arg;            /* subparser argument this selection belongs to */
+  int idx;                /* index of this selection, in order of addition */
   ap_sub *next;
 };
 
+/* strictest alignment any internal allocation needs (doubles and 64-bit
+ * integers need more than pointers on some 32-bit ABIs, like ARM EABI) */
+typedef union ap_align {
+  void *p;
+  size_t s;
+  long l;
+  double d;
+  ap_uint64 u;
+} ap_align;
+
+#define AP_ALIGN(n)                                                            \
+  (((n) + sizeof(ap_align) - 1) / sizeof(ap_align) * sizeof(ap_align))
+
+/* arena chunk, followed by the memory it hands out */
+typedef struct ap_arena_chunk ap_arena_chunk;
+struct ap_arena_chunk {
+  ap_arena_chunk *next; /* previously filled chunk */
+  size_t size;          /* size of this chunk in bytes, including header */
+};
+
+/* bump allocator that backs every node of a parser tree in arena mode */
+typedef struct ap_arena {
+  ap_arena_chunk *chunks; /* most recent chunk first */
+  char *ptr;              /* next free byte in the current chunk */
+  size_t left;            /* bytes left in the current chunk */
+} ap_arena;
+
+#define AP_ARENA_CHUNK 4096 /* size of the first arena chunk */
+
+/* option record: one per option visible in a parser, inherited or not. This
+ * holds everything needed to match and dispatch an option, so parsing only
+ * touches the argument itself for subparsers and error messages. */
+typedef struct ap_rec {
+  const char *name;   /* long opt, copied into the string pool (may be NULL) */
+  size_t len;         /* strlen() of name */
+  int flags;          /* copy of `arg->flags` */
+  ap_cb cb;           /* copy of `arg->cb` */
+  void *user;         /* copy of `arg->user` */
+  unsigned long mask; /* copy of `arg->mask` */
+  size_t offset;      /* copy of `arg->offset` */
+  ap_arg *arg;        /* the argument itself */
+} ap_rec;
+
+/* subparser record: one per named subparser of a parser */
+typedef struct ap_sub_rec {
+  const char *name; /* command name, copied into the string pool */
+  size_t len;       /* strlen() of name */
+  ap_arg *arg;      /* subparser argument the selection belongs to */
+  ap_sub *sub;      /* the selection itself */
+} ap_sub_rec;
+
+/* lookup tables built from the argument list, stored in one block laid out as
+ * [ap_index][ap_rec...][ap_sub_rec...][long slots][short slots][sub slots]
+ * [string pool], where slots hold (record index + 1) or 0 if empty */
+typedef struct ap_index {
+  size_t size;          /* size of the allocation, 0 if part of a tree block */
+  ap_rec *recs;         /* own options first, then the parent's records */
+  int nrecs;            /* number of records in `recs` */
+  size_t nlong;         /* number of records in `recs` with a long opt */
+  ap_sub_rec *sub_recs; /* subparser records */
+  int nsub_recs;        /* number of records in `sub_recs` */
+  size_t long_mask;     /* number of long option slots - 1 */
+  int *longs;           /* long option hash table, parents merged in */
+  int *shorts;          /* short option char -> record, parents merged in */
+  size_t sub_mask;      /* number of subparser slots - 1 */
+  int *subs;            /* subparser name hash table */
+} ap_index;
+
+/* text rendered once and cached on a parser */
+typedef struct ap_text {
+  char *text;        /* the NUL-terminated text (NULL if not rendered) */
+  size_t len;        /* length of `text` */
+  unsigned long rev; /* parser's `rev` when rendered */
+} ap_text;
+
 /* argument parser */
 struct ap {
   const ap_ctxcb *ctxcb;   /* context callbacks (replicated in subparsers) */
@@ -46,6 +133,29 @@ struct ap {
   ap *parent;              /* parent for subparser arg search */
   const char *description; /* help description */
   const char *epilog;      /* help epilog */
+  ap_index *index;         /* lookup tables (NULL if not yet built) */
+  unsigned long rev;       /* bumped whenever the argument list changes */
+  unsigned long index_rev; /* value of `rev` when `index` was built */
+  unsigned long index_gen; /* bumped whenever `index` is rebuilt */
+  unsigned long index_parent_gen; /* parent's `index_gen` when built */
+  int frozen;                     /* 1 once compiled with `ap_compile` */
+  ap_arena *arena; /* allocator shared by the parser tree (NULL if none) */
+  ap_text usage;   /* cached usage text */
+  ap_text help;    /* cached help text */
+  int help_width;  /* width to lay help out for, 0 for the classic layout */
+};
+
+/* size of the buffer a session keeps its last error message in */
+#define AP_SESSION_MSG 256
+
+/* parse session: all of the state a parse writes to, apart from the results,
+ * so that sessions can share a compiled parser */
+struct ap_session {
+  ap *par;                      /* the compiled parser */
+  void *base;                   /* base pointer passed to callbacks */
+  ap *err_par;                  /* parser of the last error (NULL if none) */
+  ap_arg *err_arg;              /* argument of the last error */
+  char err_msg[AP_SESSION_MSG]; /* message of the last error */
 };
 
 /* callback wrappers */
@@ -68,22 +178,152 @@ void *ap_cb_realloc(ap *parser, void *ptr, size_t o, size_t n) {
              : realloc(ptr, n);
 }
 
-int ap_cb_out(ap *parser, const char *text, size_t n) {
-  return parser->ctxcb->print
-             ? parser->ctxcb->print(parser->ctxcb->uptr, AP_FD_OUT, text, n)
-             : (fwrite(text, 1, n, stdout) < n ? AP_ERR_IO : AP_ERR_NONE);
+void *ap_arena_alloc(const ap_ctxcb *cb, ap_arena *arena, size_t n) {
+  void *out;
+  n = AP_ALIGN(n);
+  if (n > arena->left) {
+    /* chunks double in size, so a tree needs only a handful of them */
+    size_t hdr = AP_ALIGN(sizeof(ap_arena_chunk)),
+           size = arena->chunks ? arena->chunks->size * 2 : AP_ARENA_CHUNK;
+    ap_arena_chunk *chunk;
+    while (size < hdr + n)
+      size *= 2;
+    chunk = cb->alloc ? cb->alloc(cb->uptr, NULL, 0, size) : malloc(size);
+    if (!chunk)
+      return NULL;
+    chunk->next = arena->chunks;
+    chunk->size = size;
+    arena->chunks = chunk;
+    arena->ptr = (char *)chunk + hdr;
+    arena->left = size - hdr;
+  }
+  out = arena->ptr;
+  arena->ptr += n;
+  arena->left -= n;
+  return out;
+}
+
+void ap_arena_free(const ap_ctxcb *cb, ap_arena *arena) {
+  /* the arena lives in one of its own chunks, so don't touch it after this */
+  ap_arena_chunk *chunk = arena->chunks;
+  while (chunk) {
+    ap_arena_chunk *next = chunk->next;
+    if (cb->alloc)
+      cb->alloc(cb->uptr, chunk, chunk->size, 0);
+    else
+      free(chunk);
+    chunk = next;
+  }
+}
+
+/* allocate a node of the parser tree (an arg, subparser, table...) */
+void *ap_node_alloc(ap *parser, size_t n) {
+  return parser->arena ? ap_arena_alloc(parser->ctxcb, parser->arena, n)
+                       : ap_cb_malloc(parser, n);
+}
+
+/* free a node of the parser tree; arena nodes are released all at once */
+void ap_node_free(ap *parser, void *ptr, size_t n) {
+  if (!parser->arena)
+    ap_cb_free(parser, ptr, n);
+}
+
+/* resize a node of the parser tree; arena nodes are copied */
+void *ap_node_realloc(ap *parser, void *ptr, size_t o, size_t n) {
+  void *out;
+  if (!parser->arena)
+    return ap_cb_realloc(parser, ptr, o, n);
+  if ((out = ap_arena_alloc(parser->ctxcb, parser->arena, n)) && o)
+    memcpy(out, ptr, o < n ? o : n);
+  return out;
+}
+
+/* size of the buffer output is coalesced in before reaching `print` */
+#define AP_OUT_BUF 1024
+
+/* `ap_out.fd` of a sink that copies into memory instead of printing */
+#define AP_OUT_MEM -1
+
+/* buffered output sink, so that rendering help or an error reaches the print
+ * callback in one or a few calls instead of one per fragment */
+typedef struct ap_out {
+  ap *par;
+  int fd;               /* AP_FD_xxx to flush to, or AP_OUT_MEM */
+  char *dst;            /* AP_OUT_MEM: where to copy chars (may be NULL) */
+  size_t cap;           /* AP_OUT_MEM: size of `dst` */
+  size_t total;         /* number of chars written in total */
+  size_t len;           /* number of buffered chars */
+  char buf[AP_OUT_BUF]; /* buffered chars */
+} ap_out;
+
+void ap_out_init(ap_out *out, ap *par, int fd) {
+  out->par = par;
+  out->fd = fd;
+  out->dst = NULL;
+  out->cap = out->total = out->len = 0;
+}
+
+/* init a sink that copies up to `cap` chars into `dst` and counts the rest */
+void ap_out_init_mem(ap_out *out, ap *par, char *dst, size_t cap) {
+  ap_out_init(out, par, AP_OUT_MEM);
+  out->dst = dst;
+  out->cap = cap;
+}
+
+/* init a memory sink with snprintf-like semantics for a `size`-byte buffer,
+ * leaving room for the NUL terminator */
+void ap_out_init_buf(ap_out *out, ap *par, char *buf, size_t size) {
+  ap_out_init_mem(out, par, size ? buf : NULL, size ? size - 1 : 0);
+}
+
+/* NUL-terminate the buffer of a sink from `ap_out_init_buf` and return the
+ * length of the full output */
+size_t ap_out_end_buf(ap_out *out) {
+  if (out->dst)
+    out->dst[out->total < out->cap ? out->total : out->cap] = '\0';
+  return out->total;
+}
+
+/* send text straight to the print callback */
+int ap_print(ap *par, int fd, const char *text, size_t n) {
+  FILE *f = fd == AP_FD_OUT ? stdout : stderr;
+  return par->ctxcb->print
+             ? par->ctxcb->print(par->ctxcb->uptr, fd, text, n)
+             : (fwrite(text, 1, n, f) < n ? AP_ERR_IO : AP_ERR_NONE);
 }
 
-int ap_cb_err(ap *parser, const char *text, size_t n) {
-  return parser->ctxcb->print
-             ? parser->ctxcb->print(parser->ctxcb->uptr, AP_FD_ERR, text, n)
-             : (fwrite(text, 1, n, stderr) < n ? AP_ERR_IO : AP_ERR_NONE);
+int ap_out_flush(ap_out *out) {
+  int err = AP_ERR_NONE;
+  if (out->len)
+    err = ap_print(out->par, out->fd, out->buf, out->len);
+  out->len = 0;
+  return err;
 }
 
-typedef int (*ap_print_func)(ap *par, const char *string, size_t n);
+int ap_out_write(ap_out *out, const char *text, size_t n) {
+  int err;
+  if (out->fd == AP_OUT_MEM) {
+    if (out->total < out->cap)
+      memcpy(out->dst + out->total, text,
+             n < out->cap - out->total ? n : out->cap - out->total);
+    out->total += n;
+    return AP_ERR_NONE;
+  }
+  out->total += n;
+  if (out->len + n > AP_OUT_BUF) {
+    if ((err = ap_out_flush(out)))
+      return err;
+    if (n > AP_OUT_BUF)
+      /* too big to buffer anyway */
+      return ap_print(out->par, out->fd, text, n);
+  }
+  memcpy(out->buf + out->len, text, n);
+  out->len += n;
+  return AP_ERR_NONE;
+}
 
 /* printf-like implementation */
-int ap_pstrs(ap *par, ap_print_func out, const char *fmt, ...) {
+int ap_pstrs(ap_out *out, const char *fmt, ...) {
   int err = AP_ERR_NONE;
   va_list args;
   va_start(args, fmt);
@@ -93,12 +333,12 @@ int ap_pstrs(ap *par, ap_print_func out, const char *fmt, ...) {
       if (*fmt == 's') {
         const char *arg = va_arg(args, const char *);
         assert(arg);
-        if ((err = out(par, arg, strlen(arg))))
+        if ((err = ap_out_write(out, arg, strlen(arg))))
           goto done;
       } else if (*fmt == 'c') {
         int _arg = va_arg(args, int);
         char arg = (char)_arg;
-        if (arg && (err = out(par, &arg, 1)))
+        if (arg && (err = ap_out_write(out, &arg, 1)))
           goto done;
       } else {
         assert(0); /* internal error */
@@ -107,7 +347,7 @@ int ap_pstrs(ap *par, ap_print_func out, const char *fmt, ...) {
       const char *begin = fmt;
       while (*(fmt + 1) && (*(fmt + 1) != '%'))
         fmt++;
-      if ((err = out(par, begin, (size_t)(fmt - begin) + 1)))
+      if ((err = ap_out_write(out, begin, (size_t)(fmt - begin) + 1)))
         goto done;
     }
     fmt++;
@@ -117,12 +357,12 @@ done:
   return err;
 }
 
-int ap_usage(ap *par, ap_print_func out) {
+int ap_usage(ap *par, ap_out *out) {
   /* print usage without a newline */
   int err = AP_ERR_NONE;
   ap_arg *arg = par->args;
   assert(par->progname);
-  if ((err = ap_pstrs(par, out, "usage: %s", par->progname)))
+  if ((err = ap_pstrs(out, "usage: %s", par->progname)))
     return err;
   {
     /* coalesce short args */
@@ -131,11 +371,10 @@ int ap_usage(ap *par, ap_print_func out) {
       if (!((arg->flags & AP_ARG_FLAG_OPT) &&
             (arg->flags & AP_ARG_FLAG_COALESCE) && arg->opt_short))
         continue;
-      if ((err = ap_pstrs(par, out, "%s%c", !(any++) ? " [-" : "",
-                          arg->opt_short)))
+      if ((err = ap_pstrs(out, "%s%c", !(any++) ? " [-" : "", arg->opt_short)))
         return err;
     }
-    if (any && (err = ap_pstrs(par, out, "]")))
+    if (any && (err = ap_pstrs(out, "]")))
       return err;
   }
   {
@@ -145,14 +384,14 @@ int ap_usage(ap *par, ap_print_func out) {
             !((arg->flags & AP_ARG_FLAG_COALESCE) && arg->opt_short)))
         continue;
       assert(arg->opt_long || arg->opt_short);
-      if (arg->opt_short && (err = ap_pstrs(par, out, " [-%c", arg->opt_short)))
+      if (arg->opt_short && (err = ap_pstrs(out, " [-%c", arg->opt_short)))
         return err;
       else if (!arg->opt_short &&
-               (err = ap_pstrs(par, out, " [--%s", arg->opt_long)))
+               (err = ap_pstrs(out, " [--%s", arg->opt_long)))
         return err;
-      if (arg->metavar && (err = ap_pstrs(par, out, " %s", arg->metavar)))
+      if (arg->metavar && (err = ap_pstrs(out, " %s", arg->metavar)))
         return err;
-      if ((err = ap_pstrs(par, out, "]")))
+      if ((err = ap_pstrs(out, "]")))
         return err;
     }
   }
@@ -162,60 +401,139 @@ int ap_usage(ap *par, ap_print_func out) {
       if (arg->flags & AP_ARG_FLAG_OPT)
         continue;
       assert(arg->metavar);
-      if ((err = ap_pstrs(par, out, " %s", arg->metavar)))
+      if ((err = ap_pstrs(out, " %s", arg->metavar)))
         return err;
     }
   }
   return err;
 }
 
-int ap_show_argspec(ap *par, ap_arg *arg, ap_print_func out, int with_metavar) {
+int ap_show_argspec(ap_out *out, ap_arg *arg, int with_metavar) {
   int err;
   if (arg->flags & AP_ARG_FLAG_OPT) {
     /* optionals */
     char short_opt[2] = {0, 0};
     short_opt[0] = arg->opt_short;
-    if (arg->opt_short && (err = ap_pstrs(par, out, "-%c", arg->opt_short)))
+    if (arg->opt_short && (err = ap_pstrs(out, "-%c", arg->opt_short)))
       return err;
-    if (with_metavar && arg->metavar &&
-        (err = ap_pstrs(par, out, " %s", arg->metavar)))
+    if (with_metavar && arg->metavar && arg->opt_short &&
+        (err = ap_pstrs(out, " %s", arg->metavar)))
       return err;
-    if (arg->opt_long && arg->opt_short && (err = ap_pstrs(par, out, ",")))
+    if (arg->opt_long && arg->opt_short && (err = ap_pstrs(out, ",")))
       return err;
-    if (arg->opt_long && (err = ap_pstrs(par, out, "--%s", arg->opt_long)))
+    if (arg->opt_long && (err = ap_pstrs(out, "--%s", arg->opt_long)))
       return err;
-    if (with_metavar && arg->metavar &&
-        (err = ap_pstrs(par, out, " %s", arg->metavar)))
+    if (with_metavar && arg->metavar && arg->opt_long &&
+        (err = ap_pstrs(out, " %s", arg->metavar)))
       return err;
-  } else if ((err = ap_pstrs(par, out, "%s", arg->metavar)))
+  } else if ((err = ap_pstrs(out, "%s", arg->metavar)))
     /* positionals */
     return err;
   return AP_ERR_NONE;
 }
 
-int ap_error_prefix(ap *par) {
+/* signature of functions that render a parser's text, like `ap_usage` */
+typedef int (*ap_render_func)(ap *par, ap_out *out);
+
+void ap_text_free(ap *par, ap_text *t) {
+  if (t->text)
+    ap_cb_free(par, t->text, t->len + 1);
+  t->text = NULL;
+}
+
+int ap_text_fresh(ap *par, ap_text *t) {
+  return t->text && t->rev == par->rev;
+}
+
+/* render text into the cache `t` */
+int ap_text_render(ap *par, ap_text *t, ap_render_func render) {
+  ap_out out;
+  char *text;
+  /* measure first, then copy into an allocation of the right size; memory
+   * sinks never fail */
+  ap_out_init_mem(&out, par, NULL, 0);
+  render(par, &out);
+  if (!(text = ap_cb_malloc(par, out.total + 1)))
+    return AP_ERR_NOMEM;
+  ap_out_init_mem(&out, par, text, out.total);
+  render(par, &out);
+  text[out.total] = '\0';
+  ap_text_free(par, t);
+  t->text = text;
+  t->len = out.total;
+  t->rev = par->rev;
+  return AP_ERR_NONE;
+}
+
+/* make sure the cache `t` is fresh, if the parser can still be written to */
+int ap_text_ensure(ap *par, ap_text *t, ap_render_func render) {
+  if (ap_text_fresh(par, t))
+    return AP_ERR_NONE;
+  /* compiled parsers are read-only, so never fill their caches on demand */
+  return par->frozen ? AP_ERR_NOMEM : ap_text_render(par, t, render);
+}
+
+/* write text through the cache `t`, or render it directly if it can't be
+ * cached */
+int ap_text_write(ap *par, ap_text *t, ap_render_func render, ap_out *out) {
+  /* rendering into memory never allocates, so it only uses a cache that's
+   * already there */
+  if (out->fd == AP_OUT_MEM ? ap_text_fresh(par, t)
+                            : !ap_text_ensure(par, t, render))
+    return ap_out_write(out, t->text, t->len);
+  return render(par, out);
+}
+
+int ap_error_prefix(ap *par, ap_out *out) {
   int err;
-  if ((err = ap_usage(par, ap_cb_err)))
+  /* subparsers have no name of their own, so report as their program */
+  while (!par->progname && par->parent)
+    par = par->parent;
+  if ((err = ap_text_write(par, &par->usage, ap_usage, out)))
     return err;
-  if ((err = ap_pstrs(par, ap_cb_err, "\n%s: error: ", par->progname)))
+  if ((err = ap_pstrs(out, "\n%s: error: ", par->progname)))
     return err;
   return err;
 }
 
 int ap_error(ap *par, const char *error_string) {
   int err;
-  if ((err = ap_error_prefix(par)) ||
-      (err = ap_pstrs(par, ap_cb_err, "%s\n", error_string)))
+  ap_out out;
+  ap_out_init(&out, par, AP_FD_ERR);
+  if ((err = ap_error_prefix(par, &out)) ||
+      (err = ap_pstrs(&out, "%s\n", error_string)) ||
+      (err = ap_out_flush(&out)))
     return err;
   return 1;
 }
 
-int ap_arg_error_internal(ap *par, ap_arg *arg, const char *error_string) {
+int ap_arg_error_render(
+    ap *par, ap_out *out, ap_arg *arg, const char *error_string) {
+  int err;
+  if ((err = ap_error_prefix(par, out)) || (err = ap_pstrs(out, "argument ")) ||
+      (err = ap_show_argspec(out, arg, 0)) ||
+      (err = ap_pstrs(out, ": %s\n", error_string)))
+    return err;
+  return AP_ERR_NONE;
+}
+
+int ap_arg_error_internal(
+    ap *par, ap_session *sess, ap_arg *arg, const char *error_string) {
   int err;
-  if ((err = ap_error_prefix(par)) ||
-      (err = ap_pstrs(par, ap_cb_err, "argument ")) ||
-      (err = ap_show_argspec(par, arg, ap_cb_err, 0)) ||
-      (err = ap_pstrs(par, ap_cb_err, ": %s\n", error_string)))
+  ap_out out;
+  if (sess) {
+    /* sessions keep the error to be rendered later, if at all */
+    size_t len = strlen(error_string);
+    if (len >= sizeof(sess->err_msg))
+      len = sizeof(sess->err_msg) - 1;
+    memcpy(sess->err_msg, error_string, len);
+    sess->err_msg[len] = '\0';
+    sess->err_par = par, sess->err_arg = arg;
+    return AP_ERR_PARSE;
+  }
+  ap_out_init(&out, par, AP_FD_ERR);
+  if ((err = ap_arg_error_render(par, &out, arg, error_string)) ||
+      (err = ap_out_flush(&out)))
     return err;
   return AP_ERR_PARSE;
 }
@@ -224,8 +542,8 @@ int ap_arg_error(ap_cb_data *cbd, const char *error_string) {
   ap *par = cbd->parser;
   ap_arg *arg = cbd->reserved;
   /* if this fails, you tried to call ap_arg_error from a destructor callback */
-  assert(!arg || cbd->destroy);
-  return ap_arg_error_internal(par, arg, error_string);
+  assert(arg && !cbd->destroy);
+  return ap_arg_error_internal(par, cbd->session, arg, error_string);
 }
 
 /* default callbacks (stubbed to NULL so that we know to use default funcs) */
@@ -237,6 +555,18 @@ ap *ap_init(const char *progname) {
   return (ap_init_full(&out, progname, NULL) == AP_ERR_NONE) ? out : NULL;
 }
 
+void ap_init_par(ap *par, const char *progname, const ap_ctxcb *pctxcb) {
+  memset(par, 0, sizeof(*par));
+  par->ctxcb = pctxcb;
+  par->progname = progname;
+  par->args = NULL;
+  par->args_tail = NULL;
+  par->current = NULL;
+  par->parent = NULL;
+  par->index = NULL;
+  par->arena = NULL;
+}
+
 int ap_init_full(ap **out, const char *progname, const ap_ctxcb *pctxcb) {
   ap *par;
   /* do a little dance to use the correct malloc callback before we've actually
@@ -244,15 +574,26 @@ int ap_init_full(ap **out, const char *progname, const ap_ctxcb *pctxcb) {
   pctxcb = pctxcb ? pctxcb : &ap_default_ctxcb;
   par = pctxcb->alloc ? pctxcb->alloc(pctxcb->uptr, NULL, 0, sizeof(ap))
                       : malloc(sizeof(ap));
-  memset(par, 0, sizeof(*par));
   if (!par)
     return AP_ERR_NOMEM;
-  par->ctxcb = pctxcb;
-  par->progname = progname;
-  par->args = NULL;
-  par->args_tail = NULL;
-  par->current = NULL;
-  par->parent = NULL;
+  ap_init_par(par, progname, pctxcb);
+  *out = par;
+  return AP_ERR_NONE;
+}
+
+int ap_init_arena(ap **out, const char *progname, const ap_ctxcb *pctxcb) {
+  ap_arena arena = {0}, *parena;
+  ap *par;
+  pctxcb = pctxcb ? pctxcb : &ap_default_ctxcb;
+  /* the arena's first chunk holds the arena itself and the root parser */
+  if (!(parena = ap_arena_alloc(pctxcb, &arena, sizeof(ap_arena))))
+    return AP_ERR_NOMEM;
+  par = ap_arena_alloc(pctxcb, &arena, sizeof(ap));
+  /* if this fails, AP_ARENA_CHUNK is too small to hold the root parser */
+  assert(par);
+  *parena = arena;
+  ap_init_par(par, progname, pctxcb);
+  par->arena = parena;
   *out = par;
   return AP_ERR_NONE;
 }
@@ -265,9 +606,10 @@ void ap_destroy(ap *par) {
       ap_sub *sub = (ap_sub *)prev->user;
       while (sub) {
         ap_sub *prev_sub = sub;
-        ap_destroy(prev_sub->par);
+        if (prev_sub->par)
+          ap_destroy(prev_sub->par);
         sub = sub->next;
-        ap_cb_free(par, prev_sub, sizeof(*prev_sub));
+        ap_node_free(par, prev_sub, sizeof(*prev_sub));
       }
     } else if (prev->flags & AP_ARG_FLAG_DESTRUCTOR) {
       /* destroy arguments that requested it */
@@ -277,19 +619,55 @@ void ap_destroy(ap *par) {
       prev->cb(prev->user, &data);
     }
     par->args = par->args->next;
-    ap_cb_free(par, prev, sizeof(*prev));
+    ap_node_free(par, prev, sizeof(*prev));
   }
-  ap_cb_free(par, par, sizeof(*par));
+  if (par->index && par->index->size)
+    ap_node_free(par, par->index, par->index->size);
+  ap_text_free(par, &par->usage);
+  ap_text_free(par, &par->help);
+  if (par->arena && !par->parent)
+    /* root of an arena tree: release everything at once */
+    ap_arena_free(par->ctxcb, par->arena);
+  else
+    ap_node_free(par, par, sizeof(*par));
 }
 
 void ap_description(ap *par, const char *description) {
+  /* if this fails, you modified a parser after calling ap_compile */
+  assert(!par->frozen);
+  /* only the help text shows the description */
+  ap_text_free(par, &par->help);
   par->description = description;
 }
 
-void ap_epilog(ap *par, const char *epilog) { par->epilog = epilog; }
+void ap_help_width(ap *par, int width) {
+  /* if this fails, you modified a parser after calling ap_compile */
+  assert(!par->frozen);
+  if (width < 0) {
+    const char *columns = getenv("COLUMNS");
+    width = columns ? atoi(columns) : 0;
+    if (width <= 0)
+      width = 80;
+  }
+  ap_text_free(par, &par->help);
+  par->help_width = width;
+}
+
+void ap_epilog(ap *par, const char *epilog) {
+  /* if this fails, you modified a parser after calling ap_compile */
+  assert(!par->frozen);
+  ap_text_free(par, &par->help);
+  par->epilog = epilog;
+}
+
+void ap_touch(ap *par) {
+  /* if this fails, you modified a parser after calling ap_compile */
+  assert(!par->frozen);
+  par->rev++;
+}
 
 int ap_begin(ap *par) {
-  ap_arg *next = (ap_arg *)ap_cb_malloc(par, sizeof(ap_arg));
+  ap_arg *next = (ap_arg *)ap_node_alloc(par, sizeof(ap_arg));
   if (!next)
     return AP_ERR_NOMEM;
   memset(next, 0, sizeof(*next));
@@ -298,6 +676,7 @@ int ap_begin(ap *par) {
   else /* next argument, link to end */
     par->args_tail->next = next, par->args_tail = next;
   par->current = next;
+  ap_touch(par);
   return AP_ERR_NONE;
 }
 
@@ -325,6 +704,8 @@ int ap_opt(ap *par, char short_opt, const char *long_opt) {
 void ap_check_arg(ap *par) {
   /* if this fails, you forgot to call ap_pos or ap_opt */
   assert(par->current);
+  /* the current argument is about to change, and option records copy it */
+  ap_touch(par);
 }
 
 void ap_help(ap *par, const char *help) {
@@ -346,21 +727,84 @@ void ap_type_sub(ap *par, const char *metavar, int *out_idx) {
   par->current->user1 = (void *)out_idx;
 }
 
-int ap_sub_add(ap *par, const char *name, ap **subpar) {
-  int err = 0;
-  ap_sub *sub = ap_cb_malloc(par, sizeof(ap_sub));
+void ap_type_sub_at(ap *par, const char *metavar, size_t offset) {
+  ap_type_sub(par, metavar, NULL);
+  /* not `ap_at`: `user` holds the selections */
+  par->current->offset = offset;
+  par->current->flags |= AP_ARG_FLAG_AT;
+}
+
+/* add a selection to the current subparser argument, without its parser */
+int ap_sub_add_internal(ap *par, const char *name, ap_sub **out) {
+  ap_sub *sub = ap_node_alloc(par, sizeof(ap_sub));
   ap_check_arg(par);
   if (!sub)
     return AP_ERR_NOMEM;
-  if ((err = ap_init_full(subpar, NULL, par->ctxcb))) {
-    ap_cb_free(par, sub, sizeof(*sub));
-    return err;
-  }
+  memset(sub, 0, sizeof(*sub));
   sub->identifier = name;
   sub->next = par->current->user;
-  sub->par = *subpar;
+  sub->arg = par->current;
+  sub->idx = sub->next ? sub->next->idx + 1 : 0;
   par->current->user = sub;
-  return 0;
+  ap_touch(par);
+  *out = sub;
+  return AP_ERR_NONE;
+}
+
+/* allocate the parser of a selection, as a subparser of `par` */
+int ap_sub_init(ap *par, ap_sub *sub) {
+  if (!(sub->par = ap_node_alloc(par, sizeof(ap))))
+    return AP_ERR_NOMEM;
+  ap_init_par(sub->par, NULL, par->ctxcb);
+  sub->par->arena = par->arena;
+  sub->par->parent = par;
+  sub->par->help_width = par->help_width;
+  return AP_ERR_NONE;
+}
+
+int ap_sub_add(ap *par, const char *name, ap **subpar) {
+  int err;
+  ap_sub *sub;
+  if ((err = ap_sub_add_internal(par, name, &sub)))
+    return err;
+  if ((err = ap_sub_init(par, sub))) {
+    /* unlink the selection again */
+    par->current->user = sub->next;
+    ap_node_free(par, sub, sizeof(*sub));
+    return err;
+  }
+  *subpar = sub->par;
+  return AP_ERR_NONE;
+}
+
+int ap_sub_add_lazy(
+    ap *par, const char *name, ap_sub_builder builder, void *user) {
+  int err;
+  ap_sub *sub;
+  /* if this fails, you didn't pass a builder */
+  assert(builder);
+  if ((err = ap_sub_add_internal(par, name, &sub)))
+    return err;
+  sub->builder = builder;
+  sub->builder_user = user;
+  return AP_ERR_NONE;
+}
+
+/* build the parser of a lazily-added selection, if not yet built */
+int ap_sub_build(ap *par, ap_sub *sub) {
+  int err;
+  if (sub->par)
+    return AP_ERR_NONE;
+  /* if this fails, a subparser was added with neither a parser nor builder */
+  assert(sub->builder);
+  if ((err = ap_sub_init(par, sub)))
+    return err;
+  if ((err = sub->builder(sub->builder_user, sub->par)) < 0) {
+    ap_destroy(sub->par);
+    sub->par = NULL;
+    return err;
+  }
+  return AP_ERR_NONE;
 }
 
 void ap_end(ap *par) {
@@ -378,6 +822,7 @@ void ap_type_custom(ap *par, ap_cb callback, void *user) {
   ap_check_arg(par);
   par->current->cb = callback;
   par->current->user = user;
+  par->current->flags &= ~(AP_ARG_FLAG_AT | AP_ARG_FLAG_NOVALUE);
 }
 
 void ap_custom_dtor(ap *par, int enable) {
@@ -387,6 +832,13 @@ void ap_custom_dtor(ap *par, int enable) {
   par->current->flags = (par->current->flags & ~AP_ARG_FLAG_DESTRUCTOR) | flag;
 }
 
+void ap_custom_novalue(ap *par, int enable) {
+  int flag = enable * AP_ARG_FLAG_NOVALUE;
+  ap_check_arg(par);
+  assert(enable == 0 || enable == 1);
+  par->current->flags = (par->current->flags & ~AP_ARG_FLAG_NOVALUE) | flag;
+}
+
 int ap_flag_cb(void *uptr, ap_cb_data *pdata) {
   int *out = (int *)uptr;
   (void)(pdata);
@@ -396,12 +848,166 @@ int ap_flag_cb(void *uptr, ap_cb_data *pdata) {
 
 void ap_type_flag(ap *par, int *out) {
   ap_type_custom(par, ap_flag_cb, (void *)out);
-  par->current->flags |= AP_ARG_FLAG_COALESCE;
+  par->current->flags |= AP_ARG_FLAG_COALESCE | AP_ARG_FLAG_NOVALUE;
+}
+
+/* the parser sets bits itself, but bit flags still get a callback so that
+ * they're complete arguments */
+int ap_flag_bit_cb(void *uptr, ap_cb_data *pdata) {
+  unsigned long *word = (unsigned long *)uptr;
+  const ap_arg *arg = (const ap_arg *)pdata->reserved;
+  *word |= arg->mask;
+  return 0;
+}
+
+void ap_type_flag_bit(ap *par, unsigned long *words, int bit) {
+  /* if this fails, you passed a negative bit number */
+  assert(bit >= 0);
+  ap_type_custom(par, ap_flag_bit_cb, (void *)(words + AP_FLAG_WORD(bit)));
+  par->current->mask = AP_FLAG_MASK(bit);
+  par->current->flags |=
+      AP_ARG_FLAG_COALESCE | AP_ARG_FLAG_BIT | AP_ARG_FLAG_NOVALUE;
+}
+
+/* bind the output of the current argument to `offset` bytes past the base
+ * pointer of each parse, instead of to the pointer its type was given */
+void ap_at(ap *par, size_t offset) {
+  ap_check_arg(par);
+  par->current->user = NULL;
+  par->current->offset = offset;
+  par->current->flags |= AP_ARG_FLAG_AT;
+}
+
+void ap_type_flag_at(ap *par, size_t offset) {
+  ap_type_flag(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_flag_bit_at(ap *par, size_t offset, int bit) {
+  /* if this fails, you passed a negative bit number */
+  assert(bit >= 0);
+  ap_type_custom(par, ap_flag_bit_cb, NULL);
+  par->current->mask = AP_FLAG_MASK(bit);
+  par->current->flags |=
+      AP_ARG_FLAG_COALESCE | AP_ARG_FLAG_BIT | AP_ARG_FLAG_NOVALUE;
+  ap_at(par, offset + sizeof(unsigned long) * AP_FLAG_WORD(bit));
+}
+
+/* the output of a type that keeps its own state in `user`: `out`, or if that's
+ * NULL, `offset` bytes past the base pointer of the parse */
+void *ap_node_out(void *out, size_t offset, ap_cb_data *pdata) {
+  if (out)
+    return out;
+  /* if this fails, an argument is bound to an offset, but you didn't pass a
+   * base pointer with ap_parse_into or ap_session_reset */
+  assert(pdata->base);
+  return (char *)pdata->base + offset;
+}
+
+#define AP_UINT64_MAX ((ap_uint64)-1)
+#define AP_INT64_MAX ((ap_int64)(AP_UINT64_MAX >> 1))
+#define AP_INT64_MIN (-AP_INT64_MAX - 1)
+
+/* results of the number parsing kernels */
+#define AP_NUM_OK 0      /* parsed */
+#define AP_NUM_INVALID 1 /* not a number, or trailing garbage */
+#define AP_NUM_RANGE 2   /* a number, but out of range */
+
+int ap_fold(int c) { return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+int ap_digit(int c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  else if (c >= 'a' && c <= 'z')
+    return c - 'a' + 10;
+  else if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 10;
+  return 36;
+}
+
+/* parse all `len` chars of `s` as an unsigned integer no larger than `max`
+ * - decimal: "123"
+ * - hexadecimal: "0x7b"
+ * - octal: "0o173" or "0173"
+ * - binary: "0b1111011" */
+int ap_strtou(const char *s, size_t len, ap_uint64 max, ap_uint64 *out) {
+  const char *end = s + len;
+  unsigned base = 10;
+  ap_uint64 acc = 0, lim;
+  unsigned lim_digit;
+  if (len >= 2 && s[0] == '0') {
+    if (s[1] == 'x' || s[1] == 'X')
+      base = 16, s += 2;
+    else if (s[1] == 'o' || s[1] == 'O')
+      base = 8, s += 2;
+    else if (s[1] == 'b' || s[1] == 'B')
+      base = 2, s += 2;
+    else
+      base = 8, s += 1;
+  }
+  if (s == end)
+    return AP_NUM_INVALID;
+  /* the accumulator overflows `max` once it exceeds `lim` and the next digit
+   * exceeds `lim_digit` */
+  lim = max / base;
+  lim_digit = (unsigned)(max % base);
+  for (; s < end; s++) {
+    unsigned d = (unsigned)ap_digit((unsigned char)*s);
+    if (d >= base)
+      return AP_NUM_INVALID;
+    if (acc > lim || (acc == lim && d > lim_digit)) {
+      /* keep checking the syntax, an invalid number isn't out of range */
+      for (s++; s < end; s++)
+        if ((unsigned)ap_digit((unsigned char)*s) >= base)
+          return AP_NUM_INVALID;
+      return AP_NUM_RANGE;
+    }
+    acc = acc * base + d;
+  }
+  *out = acc;
+  return AP_NUM_OK;
+}
+
+/* parse all `len` chars of `s` as an optionally-signed integer within
+ * [`min`, `max`] */
+int ap_strtoi(
+    const char *s, size_t len, ap_int64 min, ap_int64 max, ap_int64 *out) {
+  int neg = 0, res;
+  ap_uint64 mag;
+  if (len && (*s == '-' || *s == '+'))
+    neg = *s == '-', s++, len--;
+  if (neg) {
+    /* magnitude of `min`, computed without overflowing */
+    ap_uint64 lim = min < 0 ? (ap_uint64)(-(min + 1)) + 1 : 0;
+    if ((res = ap_strtou(s, len, lim, &mag)))
+      return res;
+    *out = mag ? -(ap_int64)(mag - 1) - 1 : 0;
+  } else {
+    if ((res = ap_strtou(s, len, max < 0 ? 0 : (ap_uint64)max, &mag)))
+      return res;
+    *out = (ap_int64)mag;
+  }
+  /* the limits passed to ap_strtou are clamped to zero, which needn't be in
+   * the range */
+  return *out < min || *out > max ? AP_NUM_RANGE : AP_NUM_OK;
+}
+
+/* report a failed number parse */
+int ap_num_error(ap_cb_data *pdata, int res) {
+  return ap_arg_error(pdata, res == AP_NUM_RANGE
+                                 ? "integer argument out of range"
+                                 : "invalid integer argument");
 }
 
 int ap_int_cb(void *uptr, ap_cb_data *pdata) {
-  if (!sscanf(pdata->arg, "%i", (int *)uptr))
-    return ap_arg_error(pdata, "invalid integer argument");
+  ap_int64 v;
+  int res;
+  if (!pdata->arg)
+    return ap_num_error(pdata, AP_NUM_INVALID);
+  if ((res = ap_strtoi(pdata->arg, (size_t)pdata->arg_len, INT_MIN, INT_MAX,
+                       &v)))
+    return ap_num_error(pdata, res);
+  *(int *)uptr = (int)v;
   return pdata->arg_len;
 }
 
@@ -410,131 +1016,1468 @@ void ap_type_int(ap *par, int *out) {
   ap_metavar(par, "NUM");
 }
 
-int ap_str_cb(void *uptr, ap_cb_data *pdata) {
-  const char **out = (const char **)uptr;
+int ap_int64_cb(void *uptr, ap_cb_data *pdata) {
+  int res;
   if (!pdata->arg)
-    return ap_arg_error(pdata, "expected an argument");
-  *out = pdata->arg;
+    return ap_num_error(pdata, AP_NUM_INVALID);
+  if ((res = ap_strtoi(pdata->arg, (size_t)pdata->arg_len, AP_INT64_MIN,
+                       AP_INT64_MAX, (ap_int64 *)uptr)))
+    return ap_num_error(pdata, res);
   return pdata->arg_len;
 }
 
-void ap_type_str(ap *par, const char **out) {
-  ap_type_custom(par, ap_str_cb, (void *)out);
+void ap_type_int64(ap *par, ap_int64 *out) {
+  ap_type_custom(par, ap_int64_cb, (void *)out);
+  ap_metavar(par, "NUM");
 }
 
-typedef struct ap_enum {
-  const char **choices;
-  int *out;
-  char *metavar;
-} ap_enum;
+int ap_uint_cb(void *uptr, ap_cb_data *pdata) {
+  ap_uint64 v;
+  const char *arg = pdata->arg;
+  size_t len = (size_t)pdata->arg_len;
+  int res;
+  if (!arg)
+    return ap_num_error(pdata, AP_NUM_INVALID);
+  if (len && *arg == '+')
+    arg++, len--;
+  if ((res = ap_strtou(arg, len, UINT_MAX, &v)))
+    return ap_num_error(pdata, res);
+  *(unsigned *)uptr = (unsigned)v;
+  return pdata->arg_len;
+}
 
-int ap_enum_cb(void *uptr, ap_cb_data *pdata) {
-  ap_enum *e = (ap_enum *)uptr;
-  const char **cur;
-  int i;
+void ap_type_uint(ap *par, unsigned *out) {
+  ap_type_custom(par, ap_uint_cb, (void *)out);
+  ap_metavar(par, "NUM");
+}
+
+typedef struct ap_int_range {
+  int *out;      /* output, or NULL if it's at `offset` from the base */
+  size_t offset; /* offset of the output (if `out` is NULL) */
+  int min;
+  int max;
+} ap_int_range;
+
+int ap_int_range_cb(void *uptr, ap_cb_data *pdata) {
+  ap_int_range *r = (ap_int_range *)uptr;
+  ap_int64 v;
+  int res;
   if (pdata->destroy) {
-    ap_cb_free(pdata->parser, e->metavar, strlen(e->metavar));
-    ap_cb_free(pdata->parser, e, sizeof(*e));
+    ap_node_free(pdata->parser, r, sizeof(*r));
     return AP_ERR_NONE;
   }
-  for (cur = e->choices, i = 0; *cur; cur++, i++) {
-    if (!strcmp(*cur, pdata->arg)) {
-      *e->out = i;
-      return pdata->arg_len;
-    }
-  }
-  return ap_arg_error(pdata, "invalid choice for argument");
+  if (!pdata->arg)
+    return ap_num_error(pdata, AP_NUM_INVALID);
+  if ((res = ap_strtoi(pdata->arg, (size_t)pdata->arg_len, r->min, r->max,
+                       &v)))
+    return ap_num_error(pdata, res);
+  *(int *)ap_node_out(r->out, r->offset, pdata) = (int)v;
+  return pdata->arg_len;
 }
 
-int ap_type_enum(ap *par, int *out, const char **choices) {
-  ap_enum *e;
-  /* don't pass NULL in */
-  assert(choices);
-  /* you must pass at least one choice */
-  assert(choices[0]);
-  e = ap_cb_malloc(par, sizeof(ap_enum));
-  if (!e)
+int ap_type_int_range(ap *par, int *out, int min, int max) {
+  ap_int_range *r;
+  /* if this fails, the range is empty */
+  assert(min <= max);
+  if (!(r = ap_node_alloc(par, sizeof(*r))))
     return AP_ERR_NOMEM;
-  memset(e, 0, sizeof(*e));
-  e->choices = choices;
-  e->out = out;
-  {
-    /* build metavar */
-    size_t mvs = 2;
-    const char **cur;
-    char *metavar_ptr;
-    for (cur = choices; *cur; cur++) {
-      /* make space for comma + length of string */
-      mvs += (mvs != 2) + strlen(*cur);
-    }
-    e->metavar = malloc(sizeof(char) * mvs + 1);
-    if (!e->metavar) {
-      ap_cb_free(par, e, sizeof(*e));
-      return AP_ERR_NOMEM;
-    }
-    metavar_ptr = e->metavar;
-    *(metavar_ptr++) = '{';
-    for (cur = choices; *cur; cur++) {
-      size_t l = strlen(*cur);
-      if (metavar_ptr != e->metavar + 1)
-        *(metavar_ptr++) = ',';
-      memcpy(metavar_ptr, *cur, l);
-      metavar_ptr += l;
-    }
-    *(metavar_ptr++) = '}';
-    *(metavar_ptr++) = '\0';
-  }
-  ap_type_custom(par, ap_enum_cb, (void *)e);
-  ap_metavar(par, e->metavar);
+  r->out = out;
+  r->offset = 0;
+  r->min = min;
+  r->max = max;
+  ap_type_custom(par, ap_int_range_cb, (void *)r);
+  ap_metavar(par, "NUM");
   ap_custom_dtor(par, 1);
   return AP_ERR_NONE;
 }
 
-int ap_help_cb(void *uptr, ap_cb_data *pdata) {
+int ap_type_int_range_at(ap *par, size_t offset, int min, int max) {
   int err;
-  (void)uptr;
-  (void)pdata;
-  if ((err = ap_show_help(pdata->parser)))
+  if ((err = ap_type_int_range(par, NULL, min, max)))
     return err;
-  return AP_ERR_EXIT;
+  ((ap_int_range *)par->current->user)->offset = offset;
+  return AP_ERR_NONE;
 }
 
-void ap_type_help(ap *par) {
-  ap_type_custom(par, ap_help_cb, NULL);
-  ap_help(par, "show this help text and exit");
+/* powers of ten that doubles represent exactly */
+static const double ap_pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* significant digits kept by `ap_decimal`; past these, digits are only
+ * remembered as being nonzero, which is all correct rounding needs */
+#define AP_DEC_DIGITS 800
+
+/* exact decimal number 0.d[0]d[1]...d[nd - 1] * 10^dp, used to round numbers
+ * that the fast path of `ap_strtod` can't */
+typedef struct ap_decimal {
+  unsigned char d[AP_DEC_DIGITS]; /* digit values, most significant first */
+  int nd;                         /* number of digits */
+  int dp;                         /* position of the decimal point */
+  int trunc;                      /* 1 if nonzero digits were dropped */
+} ap_decimal;
+
+/* largest shift that `ap_dec_lshift` and `ap_dec_rshift` do in one step */
+#define AP_DEC_MAX_SHIFT ((int)(sizeof(unsigned long) * CHAR_BIT) - 4)
+
+/* read the (already validated) number in [s, end) with exponent `e10` */
+void ap_dec_read(ap_decimal *a, const char *s, const char *end, int e10) {
+  int nsig = 0, point = 0; /* significant digits seen, including dropped */
+  a->nd = a->dp = a->trunc = 0;
+  if (s < end && (*s == '-' || *s == '+'))
+    s++;
+  for (; s < end && *s != 'e' && *s != 'E'; s++)
+    if (*s == '.')
+      point = 1, a->dp = nsig;
+    else if (*s == '0' && !nsig)
+      /* leading zeros only move the decimal point */
+      a->dp -= point;
+    else if (nsig++ < AP_DEC_DIGITS)
+      a->d[a->nd++] = (unsigned char)(*s - '0');
+    else if (*s != '0')
+      a->trunc = 1;
+  if (!point)
+    a->dp = nsig;
+  a->dp += e10;
+  while (a->nd && !a->d[a->nd - 1])
+    a->nd--;
 }
 
-int ap_version_cb(void *uptr, ap_cb_data *pdata) {
-  int err;
-  if ((err = ap_pstrs(pdata->parser, ap_cb_err, "%s\n", (const char *)uptr)))
-    return err;
-  return AP_ERR_EXIT;
+/* divide `a` by 2^k, for 0 < k <= AP_DEC_MAX_SHIFT */
+void ap_dec_rshift(ap_decimal *a, int k) {
+  int r = 0, w = 0;
+  unsigned long n = 0, mask = (1UL << k) - 1;
+  /* pick up enough leading digits for the first output digit */
+  for (; !(n >> k); r++) {
+    if (r >= a->nd) {
+      if (!n) {
+        a->nd = 0;
+        return;
+      }
+      for (; !(n >> k); r++)
+        n *= 10;
+      break;
+    }
+    n = n * 10 + a->d[r];
+  }
+  a->dp -= r - 1;
+  /* pick up a digit, put down a digit */
+  for (; r < a->nd; r++) {
+    a->d[w++] = (unsigned char)(n >> k);
+    n = (n & mask) * 10 + a->d[r];
+  }
+  /* put down the rest */
+  for (; n; n = (n & mask) * 10)
+    if (w < AP_DEC_DIGITS)
+      a->d[w++] = (unsigned char)(n >> k);
+    else if (n >> k)
+      a->trunc = 1;
+  for (a->nd = w; a->nd && !a->d[a->nd - 1];)
+    a->nd--;
 }
 
-void ap_type_version(ap *par, const char *version) {
-  ap_type_custom(par, ap_version_cb, (void *)version);
-  ap_help(par, "show version text and exit");
+/* multiply `a` by 2^k, for 0 < k <= AP_DEC_MAX_SHIFT */
+void ap_dec_lshift(ap_decimal *a, int k) {
+  /* 2^k has at most k * log10(2) + 1 digits, so the product has at most that
+   * many more digits than `a`: write it right-aligned to that bound */
+  int grow = k * 31 / 100 + 2, r = a->nd - 1, w = r + grow, first, end;
+  unsigned long n = 0;
+  for (; r >= 0 || n; r--, w--) {
+    unsigned long q;
+    if (r >= 0)
+      n += (unsigned long)a->d[r] << k;
+    q = n / 10;
+    if (w < AP_DEC_DIGITS)
+      a->d[w] = (unsigned char)(n - q * 10);
+    else if (n - q * 10)
+      a->trunc = 1;
+    n = q;
+  }
+  first = w + 1;
+  end = a->nd + grow < AP_DEC_DIGITS ? a->nd + grow : AP_DEC_DIGITS;
+  a->nd = end > first ? end - first : 0;
+  memmove(a->d, a->d + first, (size_t)a->nd);
+  a->dp += grow - first;
+  while (a->nd && !a->d[a->nd - 1])
+    a->nd--;
 }
 
-typedef struct ap_parser {
-  int argc;
-  const char *const *argv;
-  int idx;
-  int arg_idx;
-  int arg_len;
-} ap_parser;
+/* multiply `a` by 2^k, for any k */
+void ap_dec_shift(ap_decimal *a, int k) {
+  if (k > 0)
+    for (; k > 0; k -= AP_DEC_MAX_SHIFT)
+      ap_dec_lshift(a, k < AP_DEC_MAX_SHIFT ? k : AP_DEC_MAX_SHIFT);
+  else
+    for (; k < 0; k += AP_DEC_MAX_SHIFT)
+      ap_dec_rshift(a, -k < AP_DEC_MAX_SHIFT ? -k : AP_DEC_MAX_SHIFT);
+}
 
-void ap_parser_init(ap_parser *ctx, int argc, const char *const *argv) {
-  ctx->argc = argc;
-  ctx->argv = argv;
-  ctx->idx = 0;
-  ctx->arg_idx = 0;
-  ctx->arg_len = (ctx->idx == ctx->argc) ? 0 : (int)strlen(ctx->argv[ctx->idx]);
+/* whether rounding `a` to its first `nd` digits rounds up */
+int ap_dec_round_up(const ap_decimal *a, int nd) {
+  if (nd < 0 || nd >= a->nd)
+    return 0;
+  if (a->d[nd] == 5 && nd + 1 == a->nd)
+    /* halfway, unless nonzero digits were dropped: round to even */
+    return a->trunc || (nd > 0 && a->d[nd - 1] % 2);
+  return a->d[nd] >= 5;
 }
 
-void ap_parser_advance(ap_parser *ctx, int amt) {
-  if (!amt)
-    return;
+/* `x` * 2^e, which is exact when the result is representable */
+double ap_scale2(double x, int e) {
+  for (; e > 30; e -= 30)
+    x *= 1073741824.0;
+  for (; e < -30; e += 30)
+    x /= 1073741824.0;
+  return e < 0 ? x / (double)(1L << -e) : x * (double)(1L << e);
+}
+
+/* round `a` once, directly to a float (if `is_float`) or a double (this
+ * assumes binary floating point, like the rest of the world) */
+int ap_dec_to_real(ap_decimal *a, int is_float, double *out) {
+  static const int pow2_digits[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+  int mant_dig = is_float ? FLT_MANT_DIG : DBL_MANT_DIG,
+      min_exp = is_float ? FLT_MIN_EXP : DBL_MIN_EXP,
+      max_exp = is_float ? FLT_MAX_EXP : DBL_MAX_EXP,
+      min_10 = is_float ? FLT_MIN_10_EXP : DBL_MIN_10_EXP,
+      max_10 = is_float ? FLT_MAX_10_EXP : DBL_MAX_10_EXP, exp = 0, n, i;
+  double mant = 0, top = ap_scale2(1, mant_dig);
+  *out = 0;
+  if (!a->nd || a->dp < min_10 - 25)
+    /* zero, or too small to round to anything else */
+    return AP_NUM_OK;
+  if (a->dp > max_10 + 1)
+    return AP_NUM_RANGE;
+  /* scale by powers of two into [0.5, 1), so that the value is 0.1... * 2^exp
+   * like the exponents in float.h */
+  while (a->dp > 0) {
+    n = a->dp < 9 ? pow2_digits[a->dp] : 27;
+    ap_dec_shift(a, -n);
+    exp += n;
+  }
+  while (a->dp < 0 || (a->dp == 0 && a->d[0] < 5)) {
+    n = -a->dp < 9 ? pow2_digits[-a->dp] : 27;
+    ap_dec_shift(a, n);
+    exp -= n;
+  }
+  if (exp < min_exp) {
+    /* subnormal: keep fewer bits */
+    ap_dec_shift(a, exp - min_exp);
+    exp = min_exp;
+  }
+  if (exp > max_exp)
+    return AP_NUM_RANGE;
+  /* take `mant_dig` bits, rounded to nearest, which a double holds exactly */
+  ap_dec_shift(a, mant_dig);
+  for (i = 0; i < a->dp; i++)
+    mant = mant * 10 + (i < a->nd ? a->d[i] : 0);
+  if (ap_dec_round_up(a, a->dp))
+    mant++;
+  if (mant == top) {
+    /* rounding carried into another bit */
+    mant /= 2;
+    if (++exp > max_exp)
+      return AP_NUM_RANGE;
+  }
+  *out = ap_scale2(mant, exp - mant_dig);
+  return AP_NUM_OK;
+}
+
+/* parse all `len` chars of `s` as a decimal floating-point number, rounded
+ * correctly to a float if `is_float`, or to a double otherwise */
+int ap_strtod(const char *s, size_t len, int is_float, double *out) {
+  const char *end = s + len, *p = s;
+  int neg = 0, any = 0, ndigits = 0, exp = 0, e10 = 0, res;
+  double mant = 0;
+  ap_decimal dec;
+  if (p < end && (*p == '-' || *p == '+'))
+    neg = *p++ == '-';
+  /* skip leading zeros, they aren't significant */
+  for (; p < end && *p == '0'; p++)
+    any = 1;
+  for (; p < end && *p >= '0' && *p <= '9'; p++, any = 1)
+    if (++ndigits <= 15)
+      mant = mant * 10 + (*p - '0');
+    else
+      exp++;
+  if (p < end && *p == '.') {
+    for (p++; p < end && *p == '0' && !ndigits; p++, any = 1)
+      exp--;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any = 1)
+      if (++ndigits <= 15)
+        mant = mant * 10 + (*p - '0'), exp--;
+  }
+  if (!any)
+    return AP_NUM_INVALID;
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int eneg = 0;
+    if (++p < end && (*p == '-' || *p == '+'))
+      eneg = *p++ == '-';
+    if (p == end)
+      return AP_NUM_INVALID;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+      /* clamp, anything this large over- or underflows anyway */
+      if (e10 < 100000)
+        e10 = e10 * 10 + (*p - '0');
+    e10 = eneg ? -e10 : e10;
+    exp += e10;
+  }
+  if (p != end)
+    return AP_NUM_INVALID;
+  if (ndigits <= (is_float ? 7 : 15) && exp >= -(is_float ? 10 : 22) &&
+      exp <= (is_float ? 10 : 22)) {
+    /* fast path (Clinger): the mantissa and power of ten are both exact, so
+     * one multiply or divide rounds correctly */
+    if (is_float) {
+      float f = (float)mant, f10 = (float)ap_pow10[exp < 0 ? -exp : exp];
+      *out = exp < 0 ? f / f10 : f * f10;
+    } else
+      *out = exp < 0 ? mant / ap_pow10[-exp] : mant * ap_pow10[exp];
+    if (neg)
+      *out = -*out;
+    return AP_NUM_OK;
+  }
+  /* slow path: exact decimal arithmetic, rounded once to the target type, so
+   * there's no double rounding and no dependence on the C library's locale */
+  ap_dec_read(&dec, s, end, e10);
+  res = ap_dec_to_real(&dec, is_float, out);
+  if (neg)
+    *out = -*out;
+  return res;
+}
+
+/* parse the argument of a double or float type argument into `out` */
+int ap_real_parse(ap_cb_data *pdata, int is_float, double *out) {
+  int res;
+  if (!pdata->arg)
+    return ap_arg_error(pdata, "invalid number argument");
+  if ((res = ap_strtod(pdata->arg, (size_t)pdata->arg_len, is_float, out)))
+    return ap_arg_error(pdata, res == AP_NUM_RANGE
+                                   ? "number argument out of range"
+                                   : "invalid number argument");
+  return AP_ERR_NONE;
+}
+
+int ap_double_cb(void *uptr, ap_cb_data *pdata) {
+  double d;
+  int err;
+  if ((err = ap_real_parse(pdata, 0, &d)))
+    return err;
+  *(double *)uptr = d;
+  return pdata->arg_len;
+}
+
+void ap_type_double(ap *par, double *out) {
+  ap_type_custom(par, ap_double_cb, (void *)out);
+  ap_metavar(par, "NUM");
+}
+
+int ap_float_cb(void *uptr, ap_cb_data *pdata) {
+  double d;
+  int err;
+  if ((err = ap_real_parse(pdata, 1, &d)))
+    return err;
+  *(float *)uptr = (float)d;
+  return pdata->arg_len;
+}
+
+void ap_type_float(ap *par, float *out) {
+  ap_type_custom(par, ap_float_cb, (void *)out);
+  ap_metavar(par, "NUM");
+}
+
+/* kinds of quantities with unit suffixes */
+#define AP_UNIT_SIZE 0     /* bytes, with SI or IEC prefixes: "512MiB" */
+#define AP_UNIT_DURATION 1 /* nanoseconds, from ns/us/ms/s/m/h/d: "250ms" */
+#define AP_UNIT_RATE 2     /* per second, with SI or IEC prefixes: "10k/s" */
+
+/* a duration unit, worth `factor` * 1000^`power` nanoseconds */
+typedef struct ap_duration_unit {
+  const char *name;
+  unsigned factor;
+  int power;
+} ap_duration_unit;
+
+static const ap_duration_unit ap_duration_units[] = {
+    {"ns", 1, 0},    {"us", 1, 1},   {"ms", 1, 2},
+    {"s", 1, 3},     {"", 1, 3},     {"m", 60, 3},
+    {"h", 3600, 3},  {"d", 86400, 3}, {NULL, 0, 0}};
+
+/* multiply `*acc` by `by`, unless that overflows */
+int ap_mul_checked(ap_uint64 *acc, ap_uint64 by) {
+  if (by && *acc > AP_UINT64_MAX / by)
+    return AP_NUM_RANGE;
+  *acc *= by;
+  return AP_NUM_OK;
+}
+
+/* parse the unit suffix `s` of a quantity of kind `kind` into its
+ * multiplier */
+int ap_unit_mult(const char *s, const char *end, int kind, ap_uint64 *mult) {
+  ap_uint64 base = 1000;
+  int power = 0, res;
+  *mult = 1;
+  if (kind == AP_UNIT_DURATION) {
+    const ap_duration_unit *u;
+    for (u = ap_duration_units; u->name; u++)
+      if (strlen(u->name) == (size_t)(end - s) &&
+          !memcmp(u->name, s, (size_t)(end - s)))
+        break;
+    if (!u->name)
+      return AP_NUM_INVALID;
+    *mult = u->factor;
+    power = u->power;
+  } else {
+    /* [prefix][i][B][/s], e.g. "k", "KiB", "MB/s" */
+    static const char prefixes[] = "kmgtpe";
+    const char *prefix;
+    if (s < end && *s &&
+        (prefix = strchr(prefixes, ap_fold((unsigned char)*s)))) {
+      power = (int)(prefix - prefixes) + 1;
+      if (++s < end && ap_fold((unsigned char)*s) == 'i')
+        base = 1024, s++;
+    }
+    if (s < end && ap_fold((unsigned char)*s) == 'b')
+      s++;
+    if (kind == AP_UNIT_RATE && end - s == 2 && s[0] == '/' && s[1] == 's')
+      s += 2;
+    if (s != end)
+      return AP_NUM_INVALID;
+  }
+  while (power--)
+    if ((res = ap_mul_checked(mult, base)))
+      return res;
+  return AP_NUM_OK;
+}
+
+/* parse all `len` chars of `s` as a number, with an optional fraction, and a
+ * unit suffix for the quantity `kind`, in one pass */
+int ap_strtounit(const char *s, size_t len, int kind, ap_uint64 *out) {
+  const char *end = s + len;
+  ap_uint64 acc = 0, frac = 0, den = 1, mult, part;
+  /* keep `den` * `den` representable */
+  int frac_digits = sizeof(ap_uint64) >= 8 ? 9 : 4, any = 0, res;
+  for (; s < end && *s >= '0' && *s <= '9'; s++, any = 1) {
+    unsigned d = (unsigned)(*s - '0');
+    if (ap_mul_checked(&acc, 10) || acc > AP_UINT64_MAX - d)
+      return AP_NUM_RANGE;
+    acc += d;
+  }
+  if (s < end && *s == '.')
+    for (s++; s < end && *s >= '0' && *s <= '9'; s++, any = 1)
+      /* digits past `frac_digits` are truncated */
+      if (frac_digits > 0)
+        frac = frac * 10 + (unsigned)(*s - '0'), den *= 10, frac_digits--;
+  if (!any)
+    return AP_NUM_INVALID;
+  if ((res = ap_unit_mult(s, end, kind, &mult)))
+    return res;
+  if ((res = ap_mul_checked(&acc, mult)))
+    return res;
+  /* frac * mult / den, without overflowing the intermediate product */
+  part = mult / den * frac + mult % den * frac / den;
+  if (acc > AP_UINT64_MAX - part)
+    return AP_NUM_RANGE;
+  *out = acc + part;
+  return AP_NUM_OK;
+}
+
+int ap_unit_parse(ap_cb_data *pdata, int kind, ap_uint64 *out) {
+  static const char *const invalid[] = {
+      "invalid size argument", "invalid duration argument",
+      "invalid rate argument"};
+  static const char *const range[] = {"size argument out of range",
+                                      "duration argument out of range",
+                                      "rate argument out of range"};
+  ap_uint64 v;
+  int res;
+  if (!pdata->arg)
+    return ap_arg_error(pdata, invalid[kind]);
+  if ((res = ap_strtounit(pdata->arg, (size_t)pdata->arg_len, kind, &v)))
+    return ap_arg_error(pdata,
+                        res == AP_NUM_RANGE ? range[kind] : invalid[kind]);
+  *out = v;
+  return pdata->arg_len;
+}
+
+int ap_size_cb(void *uptr, ap_cb_data *pdata) {
+  return ap_unit_parse(pdata, AP_UNIT_SIZE, (ap_uint64 *)uptr);
+}
+
+void ap_type_size(ap *par, ap_uint64 *out) {
+  ap_type_custom(par, ap_size_cb, (void *)out);
+  ap_metavar(par, "SIZE");
+}
+
+int ap_duration_cb(void *uptr, ap_cb_data *pdata) {
+  return ap_unit_parse(pdata, AP_UNIT_DURATION, (ap_uint64 *)uptr);
+}
+
+void ap_type_duration(ap *par, ap_uint64 *out) {
+  ap_type_custom(par, ap_duration_cb, (void *)out);
+  ap_metavar(par, "DURATION");
+}
+
+int ap_rate_cb(void *uptr, ap_cb_data *pdata) {
+  return ap_unit_parse(pdata, AP_UNIT_RATE, (ap_uint64 *)uptr);
+}
+
+void ap_type_rate(ap *par, ap_uint64 *out) {
+  ap_type_custom(par, ap_rate_cb, (void *)out);
+  ap_metavar(par, "RATE");
+}
+
+int ap_str_cb(void *uptr, ap_cb_data *pdata) {
+  const char **out = (const char **)uptr;
+  if (!pdata->arg)
+    return ap_arg_error(pdata, "expected an argument");
+  *out = pdata->arg;
+  return pdata->arg_len;
+}
+
+void ap_type_str(ap *par, const char **out) {
+  ap_type_custom(par, ap_str_cb, (void *)out);
+}
+
+int ap_view_cb(void *uptr, ap_cb_data *pdata) {
+  ap_view *out = (ap_view *)uptr;
+  if (!pdata->arg)
+    return ap_arg_error(pdata, "expected an argument");
+  out->ptr = pdata->arg;
+  out->len = (size_t)pdata->arg_len;
+  return pdata->arg_len;
+}
+
+void ap_type_view(ap *par, ap_view *out) {
+  ap_type_custom(par, ap_view_cb, (void *)out);
+}
+
+void ap_type_int_at(ap *par, size_t offset) {
+  ap_type_int(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_int64_at(ap *par, size_t offset) {
+  ap_type_int64(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_uint_at(ap *par, size_t offset) {
+  ap_type_uint(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_double_at(ap *par, size_t offset) {
+  ap_type_double(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_float_at(ap *par, size_t offset) {
+  ap_type_float(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_size_at(ap *par, size_t offset) {
+  ap_type_size(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_duration_at(ap *par, size_t offset) {
+  ap_type_duration(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_rate_at(ap *par, size_t offset) {
+  ap_type_rate(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_str_at(ap *par, size_t offset) {
+  ap_type_str(par, NULL);
+  ap_at(par, offset);
+}
+
+void ap_type_view_at(ap *par, size_t offset) {
+  ap_type_view(par, NULL);
+  ap_at(par, offset);
+}
+
+/* make room for `need` items of `size` bytes in list storage `items` with
+ * room for `*cap`; capacity at least doubles so that appending is amortized
+ * O(1) */
+void *ap_list_reserve(
+    ap *par, void *items, size_t need, size_t *cap, size_t size) {
+  size_t new_cap;
+  if (need <= *cap)
+    return items;
+  new_cap = *cap ? *cap * 2 : 8;
+  if (new_cap < need)
+    new_cap = need;
+  if (!(items = ap_node_realloc(par, items, *cap * size, new_cap * size)))
+    return NULL;
+  *cap = new_cap;
+  return items;
+}
+
+/* free list storage on `ap_destroy` */
+void ap_list_free(ap *par, void *items, size_t cap, size_t size) {
+  if (items)
+    ap_node_free(par, items, cap * size);
+}
+
+int ap_str_list_cb(void *uptr, ap_cb_data *pdata) {
+  ap_str_list *l = (ap_str_list *)uptr;
+  const char **items;
+  if (pdata->destroy) {
+    ap_list_free(pdata->parser, (void *)l->items, l->cap, sizeof(*items));
+    l->items = NULL, l->len = l->cap = 0;
+    return AP_ERR_NONE;
+  }
+  if (!pdata->arg)
+    return ap_arg_error(pdata, "expected an argument");
+  if (!(items = ap_list_reserve(pdata->parser, (void *)l->items, l->len + 1,
+                                &l->cap, sizeof(*items))))
+    return AP_ERR_NOMEM;
+  l->items = items;
+  l->items[l->len++] = pdata->arg;
+  return pdata->arg_len;
+}
+
+void ap_type_str_list(ap *par, ap_str_list *out) {
+  out->items = NULL, out->len = out->cap = 0;
+  ap_type_custom(par, ap_str_list_cb, (void *)out);
+  ap_custom_dtor(par, 1);
+}
+
+int ap_int_list_cb(void *uptr, ap_cb_data *pdata) {
+  ap_int_list *l = (ap_int_list *)uptr;
+  int *items, res;
+  ap_int64 v;
+  if (pdata->destroy) {
+    ap_list_free(pdata->parser, l->items, l->cap, sizeof(*items));
+    l->items = NULL, l->len = l->cap = 0;
+    return AP_ERR_NONE;
+  }
+  if (!pdata->arg)
+    return ap_num_error(pdata, AP_NUM_INVALID);
+  if ((res = ap_strtoi(pdata->arg, (size_t)pdata->arg_len, INT_MIN, INT_MAX,
+                       &v)))
+    return ap_num_error(pdata, res);
+  if (!(items = ap_list_reserve(pdata->parser, l->items, l->len + 1,
+                                &l->cap, sizeof(*items))))
+    return AP_ERR_NOMEM;
+  l->items = items;
+  l->items[l->len++] = (int)v;
+  return pdata->arg_len;
+}
+
+void ap_type_int_list(ap *par, ap_int_list *out) {
+  out->items = NULL, out->len = out->cap = 0;
+  ap_type_custom(par, ap_int_list_cb, (void *)out);
+  ap_metavar(par, "NUM");
+  ap_custom_dtor(par, 1);
+}
+
+int ap_double_list_cb(void *uptr, ap_cb_data *pdata) {
+  ap_double_list *l = (ap_double_list *)uptr;
+  double *items, v;
+  int err;
+  if (pdata->destroy) {
+    ap_list_free(pdata->parser, l->items, l->cap, sizeof(*items));
+    l->items = NULL, l->len = l->cap = 0;
+    return AP_ERR_NONE;
+  }
+  if ((err = ap_real_parse(pdata, 0, &v)))
+    return err;
+  if (!(items = ap_list_reserve(pdata->parser, l->items, l->len + 1,
+                                &l->cap, sizeof(*items))))
+    return AP_ERR_NOMEM;
+  l->items = items;
+  l->items[l->len++] = v;
+  return pdata->arg_len;
+}
+
+void ap_type_double_list(ap *par, ap_double_list *out) {
+  out->items = NULL, out->len = out->cap = 0;
+  ap_type_custom(par, ap_double_list_cb, (void *)out);
+  ap_metavar(par, "NUM");
+  ap_custom_dtor(par, 1);
+}
+
+/* SWAR digit parsing needs 64-bit words */
+#if (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L) ||             \
+    ULONG_MAX > 0xFFFFFFFFUL
+#define AP_SWAR 1
+
+/* 64-bit constant from two 32-bit halves, without C99 literals */
+#define AP_U64(hi, lo) ((ap_uint64)(hi) << 32 | (ap_uint64)(lo))
+
+/* load 8 chars so that the first is in the lowest byte */
+ap_uint64 ap_swar_load(const char *s) {
+  const unsigned char *u = (const unsigned char *)s;
+  return (ap_uint64)u[0] | (ap_uint64)u[1] << 8 | (ap_uint64)u[2] << 16 |
+         (ap_uint64)u[3] << 24 | (ap_uint64)u[4] << 32 |
+         (ap_uint64)u[5] << 40 | (ap_uint64)u[6] << 48 | (ap_uint64)u[7] << 56;
+}
+
+/* number of leading bytes of `x` (each char - '0') that are digits */
+int ap_swar_ndigits(ap_uint64 x) {
+  /* the high bit of each byte is set if that byte is >= 10 */
+  ap_uint64 hi = AP_U64(0x80808080, 0x80808080);
+  ap_uint64 m = (((x & ~hi) + AP_U64(0x76767676, 0x76767676)) | x) & hi;
+  int n = 0;
+  if (!m)
+    return 8;
+#if defined(__GNUC__)
+  if (sizeof(unsigned long) >= 8)
+    return __builtin_ctzl((unsigned long)m) / 8;
+#endif
+  for (; !(m & 0x80); m >>= 8)
+    n++;
+  return n;
+}
+
+/* value of 8 digits (each char - '0'), the first in the lowest byte */
+ap_uint64 ap_swar_value(ap_uint64 x) {
+  x = (x * 10 + (x >> 8)) & AP_U64(0x00FF00FF, 0x00FF00FF);
+  x = (x * 100 + (x >> 16)) & AP_U64(0x0000FFFF, 0x0000FFFF);
+  return (x * 10000 + (x >> 32)) & 0xFFFFFFFF;
+}
+#endif
+
+/* parse a run of decimal digits starting at `*ps` into `out`, advancing
+ * `*ps` past it; `max` (the largest accepted value) must fit in 32 bits */
+int ap_split_digits(const char **ps, const char *end, ap_uint64 max,
+                    ap_uint64 *out) {
+  const char *s = *ps, *start = s;
+  ap_uint64 acc = 0;
+#ifdef AP_SWAR
+  static const ap_uint64 scale[] = {1,      10,      100,      1000,
+                                    10000,  100000,  1000000,  10000000,
+                                    100000000};
+  /* 8 chars at a time: find how many are digits, then convert them all at
+   * once */
+  while (end - s >= 8) {
+    ap_uint64 x = ap_swar_load(s) ^ AP_U64(0x30303030, 0x30303030);
+    int n = ap_swar_ndigits(x);
+    if (!n)
+      break;
+    if (n < 8)
+      /* shift out the non-digits, which leaves leading zeros */
+      x <<= 8 * (8 - n);
+    acc = acc * scale[n] + ap_swar_value(x);
+    s += n;
+    if (acc > max)
+      return AP_NUM_RANGE;
+    if (n < 8)
+      break;
+  }
+#endif
+  for (; s < end && *s >= '0' && *s <= '9'; s++) {
+    /* scalar fallback, and the tail of the argument */
+    if (acc > (max - (unsigned)(*s - '0')) / 10)
+      return AP_NUM_RANGE;
+    acc = acc * 10 + (unsigned)(*s - '0');
+  }
+  if (s == start)
+    return AP_NUM_INVALID;
+  *ps = s;
+  *out = acc;
+  return AP_NUM_OK;
+}
+
+typedef struct ap_int_split {
+  ap_int_list *out;
+  char delim;
+  int fixed; /* 1 if `out->items` is provided by the caller */
+} ap_int_split;
+
+int ap_int_split_cb(void *uptr, ap_cb_data *pdata) {
+  ap_int_split *sp = (ap_int_split *)uptr;
+  ap_int_list *l = sp->out;
+  const char *s = pdata->arg, *end = s + pdata->arg_len, *p;
+  size_t n = 1, len = l->len;
+  int res;
+  if (pdata->destroy) {
+    if (!sp->fixed) {
+      ap_list_free(pdata->parser, l->items, l->cap, sizeof(*l->items));
+      l->items = NULL, l->len = l->cap = 0;
+    }
+    ap_node_free(pdata->parser, sp, sizeof(*sp));
+    return AP_ERR_NONE;
+  }
+  if (!s)
+    return ap_num_error(pdata, AP_NUM_INVALID);
+  /* count the values first, to make room for all of them at once */
+  for (p = s; (p = memchr(p, sp->delim, (size_t)(end - p))); p++)
+    n++;
+  if (sp->fixed && l->len + n > l->cap)
+    return ap_arg_error(pdata, "too many values");
+  if (!sp->fixed) {
+    int *items = ap_list_reserve(pdata->parser, l->items, l->len + n, &l->cap,
+                                 sizeof(*items));
+    if (!items)
+      return AP_ERR_NOMEM;
+    l->items = items;
+  }
+  for (p = s;; p++) {
+    int neg = 0;
+    ap_uint64 v;
+    if (p < end && (*p == '-' || *p == '+'))
+      neg = *p++ == '-';
+    if ((res = ap_split_digits(&p, end,
+                               neg ? (ap_uint64)INT_MAX + 1 : INT_MAX, &v)))
+      return ap_num_error(pdata, res);
+    /* only publish the new values once all of them parsed */
+    l->items[len++] = neg && v ? -(int)(v - 1) - 1 : (int)v;
+    if (p == end)
+      break;
+    else if (*p != sp->delim)
+      return ap_num_error(pdata, AP_NUM_INVALID);
+  }
+  l->len = len;
+  return pdata->arg_len;
+}
+
+int ap_type_int_split(ap *par, ap_int_list *out, char delim) {
+  ap_int_split *sp;
+  if (!(sp = ap_node_alloc(par, sizeof(*sp))))
+    return AP_ERR_NOMEM;
+  sp->out = out;
+  sp->delim = delim;
+  sp->fixed = out->items != NULL;
+  if (!sp->fixed)
+    out->cap = 0;
+  out->len = 0;
+  ap_type_custom(par, ap_int_split_cb, (void *)sp);
+  ap_metavar(par, "NUMS");
+  ap_custom_dtor(par, 1);
+  return AP_ERR_NONE;
+}
+
+size_t ap_hash(const char *s, size_t n);
+
+/* slot of `key` in the hash table of `m`, or the empty slot it belongs in */
+size_t ap_map_slot(const ap_map *m, const char *key, size_t len) {
+  size_t mask = m->nslots - 1, i = ap_hash(key, len) & mask;
+  for (; m->slots[i]; i = (i + 1) & mask) {
+    const ap_map_entry *e = m->items + m->slots[i] - 1;
+    if (e->key.len == len && !memcmp(e->key.ptr, key, len))
+      break;
+  }
+  return i;
+}
+
+/* rebuild the hash table of `m` with `nslots` slots (a power of two) */
+int ap_map_rehash(ap *par, ap_map *m, size_t nslots) {
+  size_t *slots = ap_node_alloc(par, sizeof(*slots) * nslots), i;
+  if (!slots)
+    return AP_ERR_NOMEM;
+  memset(slots, 0, sizeof(*slots) * nslots);
+  ap_list_free(par, m->slots, m->nslots, sizeof(*slots));
+  m->slots = slots, m->nslots = nslots;
+  for (i = 0; i < m->len; i++)
+    slots[ap_map_slot(m, m->items[i].key.ptr, m->items[i].key.len)] = i + 1;
+  return AP_ERR_NONE;
+}
+
+int ap_map_cb(void *uptr, ap_cb_data *pdata) {
+  ap_map *m = (ap_map *)uptr;
+  const char *arg = pdata->arg, *eq;
+  ap_map_entry *items, *e;
+  size_t slot;
+  int err;
+  if (pdata->destroy) {
+    ap_list_free(pdata->parser, m->items, m->cap, sizeof(*items));
+    ap_list_free(pdata->parser, m->slots, m->nslots, sizeof(*m->slots));
+    memset(m, 0, sizeof(*m));
+    return AP_ERR_NONE;
+  }
+  if (!arg)
+    return ap_arg_error(pdata, "expected an argument");
+  if (!(eq = memchr(arg, '=', (size_t)pdata->arg_len)) || eq == arg)
+    return ap_arg_error(pdata, "expected KEY=VALUE");
+  /* keep the table at most half full */
+  if ((m->len + 1) * 2 > m->nslots &&
+      (err = ap_map_rehash(pdata->parser, m, m->nslots ? m->nslots * 2 : 16)))
+    return err;
+  if (!m->slots[slot = ap_map_slot(m, arg, (size_t)(eq - arg))]) {
+    if (!(items = ap_list_reserve(pdata->parser, m->items, m->len + 1, &m->cap,
+                                  sizeof(*items))))
+      return AP_ERR_NOMEM;
+    m->items = items;
+    m->items[m->len].key.ptr = arg;
+    m->items[m->len].key.len = (size_t)(eq - arg);
+    m->slots[slot] = ++m->len;
+  }
+  /* later values of a key replace earlier ones */
+  e = m->items + m->slots[slot] - 1;
+  e->value.ptr = eq + 1;
+  e->value.len = (size_t)(arg + pdata->arg_len - (eq + 1));
+  return pdata->arg_len;
+}
+
+void ap_type_map(ap *par, ap_map *out) {
+  memset(out, 0, sizeof(*out));
+  ap_type_custom(par, ap_map_cb, (void *)out);
+  ap_metavar(par, "KEY=VALUE");
+  ap_custom_dtor(par, 1);
+}
+
+const ap_view *ap_map_get(const ap_map *map, const char *key, size_t len) {
+  size_t slot;
+  if (!map->nslots || !map->slots[slot = ap_map_slot(map, key, len)])
+    return NULL;
+  return &map->items[map->slots[slot] - 1].value;
+}
+
+typedef struct ap_enum {
+  const char **choices;
+  int *out;      /* output, or NULL if it's at `offset` from the base */
+  size_t offset; /* offset of the output (if `out` is NULL) */
+  char *metavar;
+  int flags;   /* bitset of AP_ENUM_xxx */
+  int n;       /* number of choices */
+  int *sorted; /* indices into `choices`, in sorted order */
+  size_t size; /* size of this allocation in bytes */
+} ap_enum;
+
+/* compare a choice to the first `len` chars of `key`, optionally ignoring
+ * ASCII case */
+int ap_enum_cmp(const char *choice, const char *key, size_t len, int icase) {
+  size_t i;
+  for (i = 0; i < len; i++) {
+    int c = (unsigned char)choice[i], k = (unsigned char)key[i];
+    if (!c)
+      return -1;
+    if (icase)
+      c = ap_fold(c), k = ap_fold(k);
+    if (c != k)
+      return c - k;
+  }
+  return !!choice[len];
+}
+
+/* total order on choice indices: sorted by string, then by index */
+int ap_enum_less(ap_enum *e, int a, int b) {
+  const char *sb = e->choices[b];
+  int cmp = ap_enum_cmp(
+      e->choices[a], sb, strlen(sb), !!(e->flags & AP_ENUM_ICASE));
+  return cmp ? cmp < 0 : a < b;
+}
+
+void ap_enum_sift(ap_enum *e, int root, int n) {
+  int child, tmp;
+  while ((child = root * 2 + 1) < n) {
+    if (child + 1 < n &&
+        ap_enum_less(e, e->sorted[child], e->sorted[child + 1]))
+      child++;
+    if (!ap_enum_less(e, e->sorted[root], e->sorted[child]))
+      return;
+    tmp = e->sorted[root], e->sorted[root] = e->sorted[child];
+    e->sorted[child] = tmp, root = child;
+  }
+}
+
+void ap_enum_sort(ap_enum *e) {
+  /* heapsort, so building the table needs no scratch memory */
+  int i, tmp;
+  for (i = 0; i < e->n; i++)
+    e->sorted[i] = i;
+  for (i = e->n / 2 - 1; i >= 0; i--)
+    ap_enum_sift(e, i, e->n);
+  for (i = e->n - 1; i > 0; i--) {
+    tmp = e->sorted[0], e->sorted[0] = e->sorted[i], e->sorted[i] = tmp;
+    ap_enum_sift(e, 0, i);
+  }
+}
+
+/* check if a choice starts with the first `len` chars of `key` */
+int ap_enum_prefix(const char *choice, const char *key, size_t len, int icase) {
+  size_t i;
+  for (i = 0; i < len; i++)
+    if (!choice[i] || (icase ? ap_fold((unsigned char)choice[i]) !=
+                                   ap_fold((unsigned char)key[i])
+                             : choice[i] != key[i]))
+      return 0;
+  return 1;
+}
+
+/* find the index of the choice matching `key`, or -1 if there is none, or -2
+ * if `key` is an ambiguous prefix */
+int ap_enum_find(ap_enum *e, const char *key, size_t len) {
+  int lo = 0, hi = e->n, icase = !!(e->flags & AP_ENUM_ICASE);
+  while (lo < hi) {
+    /* lower bound: first choice not less than `key` */
+    int mid = lo + (hi - lo) / 2;
+    if (ap_enum_cmp(e->choices[e->sorted[mid]], key, len, icase) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == e->n)
+    return -1;
+  if (!ap_enum_cmp(e->choices[e->sorted[lo]], key, len, icase))
+    return e->sorted[lo];
+  if (!(e->flags & AP_ENUM_PREFIX) ||
+      !ap_enum_prefix(e->choices[e->sorted[lo]], key, len, icase))
+    return -1;
+  /* `key` is a prefix of the choice at `lo`; it's unique if the next choice
+   * doesn't also start with it */
+  if (lo + 1 < e->n &&
+      ap_enum_prefix(e->choices[e->sorted[lo + 1]], key, len, icase))
+    return -2;
+  return e->sorted[lo];
+}
+
+int ap_enum_cb(void *uptr, ap_cb_data *pdata) {
+  ap_enum *e = (ap_enum *)uptr;
+  int i;
+  if (pdata->destroy) {
+    ap_node_free(pdata->parser, e, e->size);
+    return AP_ERR_NONE;
+  }
+  if (!pdata->arg)
+    return ap_arg_error(pdata, "expected an argument");
+  if ((i = ap_enum_find(e, pdata->arg, (size_t)pdata->arg_len)) == -2)
+    return ap_arg_error(pdata, "ambiguous choice for argument");
+  else if (i < 0)
+    return ap_arg_error(pdata, "invalid choice for argument");
+  *(int *)ap_node_out(e->out, e->offset, pdata) = i;
+  return pdata->arg_len;
+}
+
+int ap_type_enum(ap *par, int *out, const char **choices) {
+  return ap_type_enum_ex(par, out, choices, 0);
+}
+
+int ap_type_enum_ex(ap *par, int *out, const char **choices, int flags) {
+  ap_enum *e;
+  /* build metavar */
+  size_t mvs = 2, size;
+  const char **cur;
+  char *metavar_ptr;
+  int n = 0;
+  /* don't pass NULL in */
+  assert(choices);
+  /* you must pass at least one choice */
+  assert(choices[0]);
+  for (cur = choices; *cur; cur++, n++) {
+    /* make space for comma + length of string */
+    mvs += (mvs != 2) + strlen(*cur);
+  }
+  size = sizeof(ap_enum) + sizeof(int) * (size_t)n + sizeof(char) * mvs + 1;
+  e = ap_node_alloc(par, size);
+  if (!e)
+    return AP_ERR_NOMEM;
+  memset(e, 0, sizeof(*e));
+  e->choices = choices;
+  e->out = out;
+  e->flags = flags;
+  e->n = n;
+  e->size = size;
+  e->sorted = (int *)(e + 1);
+  e->metavar = (char *)(e->sorted + n);
+  metavar_ptr = e->metavar;
+  *(metavar_ptr++) = '{';
+  for (cur = choices; *cur; cur++) {
+    size_t l = strlen(*cur);
+    if (metavar_ptr != e->metavar + 1)
+      *(metavar_ptr++) = ',';
+    memcpy(metavar_ptr, *cur, l);
+    metavar_ptr += l;
+  }
+  *(metavar_ptr++) = '}';
+  *(metavar_ptr++) = '\0';
+  ap_enum_sort(e);
+  ap_type_custom(par, ap_enum_cb, (void *)e);
+  ap_metavar(par, e->metavar);
+  ap_custom_dtor(par, 1);
+  return AP_ERR_NONE;
+}
+
+int ap_type_enum_at(ap *par, size_t offset, const char **choices, int flags) {
+  int err;
+  if ((err = ap_type_enum_ex(par, NULL, choices, flags)))
+    return err;
+  ((ap_enum *)par->current->user)->offset = offset;
+  return AP_ERR_NONE;
+}
+
+int ap_help_cb(void *uptr, ap_cb_data *pdata) {
+  int err;
+  (void)uptr;
+  /* sessions don't print, they may be running on any number of threads */
+  if (!pdata->session && (err = ap_show_help(pdata->parser)))
+    return err;
+  return AP_ERR_EXIT;
+}
+
+void ap_type_help(ap *par) {
+  ap_type_custom(par, ap_help_cb, NULL);
+  ap_custom_novalue(par, 1);
+  ap_help(par, "show this help text and exit");
+}
+
+int ap_version_cb(void *uptr, ap_cb_data *pdata) {
+  int err;
+  ap_out out;
+  if (pdata->session)
+    /* like help, sessions don't print */
+    return AP_ERR_EXIT;
+  ap_out_init(&out, pdata->parser, AP_FD_ERR);
+  if ((err = ap_pstrs(&out, "%s\n", (const char *)uptr)) ||
+      (err = ap_out_flush(&out)))
+    return err;
+  return AP_ERR_EXIT;
+}
+
+void ap_type_version(ap *par, const char *version) {
+  ap_type_custom(par, ap_version_cb, (void *)version);
+  ap_custom_novalue(par, 1);
+  ap_help(par, "show version text and exit");
+}
+
+size_t ap_hash(const char *s, size_t n) {
+  /* FNV-1a */
+  size_t h = 2166136261u;
+  while (n--)
+    h = (h ^ (unsigned char)*(s++)) * 16777619u;
+  return h;
+}
+
+/* round up to a power of two at least twice `n`, so that tables stay at most
+ * half full and probe sequences stay short */
+size_t ap_index_slots(size_t n) {
+  size_t slots = 1;
+  while (slots < n * 2)
+    slots *= 2;
+  return slots;
+}
+
+/* dimensions of an index block */
+typedef struct ap_index_dims {
+  int nrecs, nsub_recs;
+  size_t nlong, long_slots, sub_slots, pool, size;
+} ap_index_dims;
+
+/* measure the index of `par`, given the dimensions of its parent's index */
+void ap_index_measure(ap *par, const ap_index_dims *parent, ap_index_dims *d) {
+  ap_arg *arg;
+  ap_sub *sub;
+  d->nrecs = parent ? parent->nrecs : 0;
+  d->nlong = parent ? parent->nlong : 0;
+  d->nsub_recs = 0, d->pool = 0;
+  for (arg = par->args; arg; arg = arg->next) {
+    if (arg->flags & AP_ARG_FLAG_OPT) {
+      d->nrecs++;
+      if (arg->opt_long)
+        d->nlong++, d->pool += strlen(arg->opt_long) + 1;
+    }
+    if (arg->flags & AP_ARG_FLAG_SUB)
+      for (sub = arg->user; sub; sub = sub->next)
+        if (sub->identifier)
+          d->nsub_recs++, d->pool += strlen(sub->identifier) + 1;
+  }
+  d->long_slots = ap_index_slots(d->nlong);
+  d->sub_slots = ap_index_slots((size_t)d->nsub_recs);
+  d->size = AP_ALIGN(
+      sizeof(ap_index) + sizeof(ap_rec) * (size_t)d->nrecs +
+      sizeof(ap_sub_rec) * (size_t)d->nsub_recs +
+      sizeof(int) * (d->long_slots + 256 + d->sub_slots) + d->pool);
+}
+
+void ap_rec_init(ap_rec *rec, ap_arg *arg) {
+  rec->name = NULL;
+  rec->len = 0;
+  rec->flags = arg->flags;
+  rec->cb = arg->cb;
+  rec->user = arg->user;
+  rec->mask = arg->mask;
+  rec->offset = arg->offset;
+  rec->arg = arg;
+}
+
+/* copy a string into the pool, returning the copy */
+const char *ap_index_pool(char **pool, const char *str, size_t len) {
+  char *out = *pool;
+  memcpy(out, str, len + 1);
+  *pool += len + 1;
+  return out;
+}
+
+/* build the index of `par` into `idx`, which is `d->size` bytes long; the
+ * parent's index must already be built */
+void ap_index_fill(ap *par, ap_index *idx, const ap_index_dims *d) {
+  ap_index *parent_idx = par->parent ? par->parent->index : NULL;
+  ap_arg *arg;
+  ap_sub *sub;
+  char *pool;
+  int i, nown = 0;
+  memset(idx, 0, d->size);
+  idx->recs = (ap_rec *)(idx + 1);
+  idx->nrecs = d->nrecs;
+  idx->nlong = d->nlong;
+  idx->sub_recs = (ap_sub_rec *)(idx->recs + d->nrecs);
+  idx->long_mask = d->long_slots - 1;
+  idx->longs = (int *)(idx->sub_recs + d->nsub_recs);
+  idx->shorts = idx->longs + d->long_slots;
+  idx->sub_mask = d->sub_slots - 1;
+  idx->subs = idx->shorts + 256;
+  pool = (char *)(idx->subs + d->sub_slots);
+  for (arg = par->args; arg; arg = arg->next) {
+    if (arg->flags & AP_ARG_FLAG_OPT) {
+      ap_rec *rec = idx->recs + nown++;
+      ap_rec_init(rec, arg);
+      if (arg->opt_long)
+        rec->len = strlen(arg->opt_long),
+        rec->name = ap_index_pool(&pool, arg->opt_long, rec->len);
+    }
+    if (arg->flags & AP_ARG_FLAG_SUB)
+      /* the most recently added subparser wins, matching the old list walk */
+      for (sub = arg->user; sub; sub = sub->next) {
+        ap_sub_rec *rec;
+        size_t j;
+        if (!sub->identifier)
+          continue;
+        rec = idx->sub_recs + idx->nsub_recs;
+        rec->len = strlen(sub->identifier);
+        for (j = ap_hash(sub->identifier, rec->len) & idx->sub_mask;
+             idx->subs[j]; j = (j + 1) & idx->sub_mask) {
+          ap_sub_rec *other = idx->sub_recs + idx->subs[j] - 1;
+          if (other->arg == arg && !strcmp(other->name, sub->identifier))
+            break;
+        }
+        if (idx->subs[j])
+          continue;
+        rec->name = ap_index_pool(&pool, sub->identifier, rec->len);
+        rec->arg = arg;
+        rec->sub = sub;
+        idx->subs[j] = ++idx->nsub_recs;
+      }
+  }
+  /* inherit the parent's records (its own, then its parent's, and so on) */
+  if (parent_idx)
+    memcpy(
+        idx->recs + nown, parent_idx->recs,
+        sizeof(ap_rec) * (size_t)(d->nrecs - nown));
+  /* records are in order of precedence: the first definition of an option
+   * wins, and options of a parser shadow options of its parents */
+  for (i = 0; i < idx->nrecs; i++) {
+    ap_rec *rec = idx->recs + i;
+    unsigned char opt_short = (unsigned char)rec->arg->opt_short;
+    if (opt_short && !idx->shorts[opt_short])
+      idx->shorts[opt_short] = i + 1;
+    if (rec->name) {
+      size_t j = ap_hash(rec->name, rec->len) & idx->long_mask;
+      for (; idx->longs[j]; j = (j + 1) & idx->long_mask)
+        if (!strcmp(idx->recs[idx->longs[j] - 1].name, rec->name))
+          break;
+      if (!idx->longs[j])
+        idx->longs[j] = i + 1;
+    }
+  }
+  par->index = idx;
+  par->index_rev = par->rev;
+  par->index_gen++;
+  if (parent_idx)
+    par->index_parent_gen = par->parent->index_gen;
+}
+
+/* get the dimensions of the parent's index, or NULL if there's no parent */
+ap_index_dims *ap_index_parent_dims(ap *par, ap_index_dims *d) {
+  if (!par->parent)
+    return NULL;
+  d->nrecs = par->parent->index->nrecs;
+  d->nlong = par->parent->index->nlong;
+  return d;
+}
+
+int ap_index_build(ap *par) {
+  ap_index_dims d, parent;
+  ap_index *old = par->index, *idx;
+  ap_index_measure(par, ap_index_parent_dims(par, &parent), &d);
+  if (!(idx = ap_node_alloc(par, d.size)))
+    return AP_ERR_NOMEM;
+  ap_index_fill(par, idx, &d);
+  idx->size = d.size;
+  if (old)
+    ap_node_free(par, old, old->size);
+  return AP_ERR_NONE;
+}
+
+int ap_index_ensure(ap *par) {
+  int err;
+  /* parents first, since their tables are merged into ours */
+  if (par->parent && (err = ap_index_ensure(par->parent)))
+    return err;
+  if (par->index && par->index_rev == par->rev &&
+      (!par->parent || par->index_parent_gen == par->parent->index_gen))
+    return AP_ERR_NONE;
+  /* if this fails, a compiled parser's tables went stale, which is a bug */
+  assert(!par->frozen);
+  return ap_index_build(par);
+}
+
+/* build every lazily-added subparser in the tree, since a compiled tree can't
+ * be modified later */
+int ap_compile_build_subs(ap *par) {
+  int err;
+  ap_arg *arg;
+  ap_sub *sub;
+  for (arg = par->args; arg; arg = arg->next)
+    if (arg->flags & AP_ARG_FLAG_SUB)
+      for (sub = arg->user; sub; sub = sub->next)
+        if ((err = ap_sub_build(par, sub)) ||
+            (err = ap_compile_build_subs(sub->par)))
+          return err;
+  return AP_ERR_NONE;
+}
+
+/* measure the blocks for `par` and all of its subparsers */
+size_t ap_compile_measure(ap *par, const ap_index_dims *parent) {
+  ap_index_dims d;
+  ap_arg *arg;
+  ap_sub *sub;
+  size_t size;
+  ap_index_measure(par, parent, &d);
+  size = d.size;
+  for (arg = par->args; arg; arg = arg->next)
+    if (arg->flags & AP_ARG_FLAG_SUB)
+      for (sub = arg->user; sub; sub = sub->next)
+        size += ap_compile_measure(sub->par, &d);
+  return size;
+}
+
+/* build the indexes of `par` and all of its subparsers, in that order, into
+ * consecutive blocks starting at `*block` */
+void ap_compile_fill(ap *par, char **block) {
+  ap_index_dims d, parent;
+  ap_arg *arg;
+  ap_sub *sub;
+  ap_index_measure(par, ap_index_parent_dims(par, &parent), &d);
+  if (par->index && par->index->size)
+    ap_node_free(par, par->index, par->index->size);
+  ap_index_fill(par, (ap_index *)*block, &d);
+  *block += d.size;
+  par->frozen = 1;
+  for (arg = par->args; arg; arg = arg->next)
+    if (arg->flags & AP_ARG_FLAG_SUB)
+      for (sub = arg->user; sub; sub = sub->next)
+        ap_compile_fill(sub->par, block);
+}
+
+int ap_help_render(ap *par, ap_out *out);
+
+/* render the cached text of `par` and all of its subparsers */
+int ap_compile_render(ap *par) {
+  int err;
+  ap_arg *arg;
+  ap_sub *sub;
+  /* subparsers don't have a program name to render usage with */
+  if (par->progname &&
+      ((err = ap_text_render(par, &par->usage, ap_usage)) ||
+       (err = ap_text_render(par, &par->help, ap_help_render))))
+    return err;
+  for (arg = par->args; arg; arg = arg->next)
+    if (arg->flags & AP_ARG_FLAG_SUB)
+      for (sub = arg->user; sub; sub = sub->next)
+        if ((err = ap_compile_render(sub->par)))
+          return err;
+  return AP_ERR_NONE;
+}
+
+int ap_compile(ap *par) {
+  int err;
+  size_t size;
+  char *block;
+  /* if this fails, you tried to compile a subparser on its own */
+  assert(!par->parent);
+  if (par->frozen)
+    return AP_ERR_NONE;
+  if ((err = ap_compile_build_subs(par)))
+    return err;
+  size = ap_compile_measure(par, NULL);
+  if (!(block = ap_node_alloc(par, size)))
+    return AP_ERR_NOMEM;
+  ap_compile_fill(par, &block);
+  /* the root's index is first, so it owns the whole block */
+  par->index->size = size;
+  return ap_compile_render(par);
+}
+
+const ap_rec *ap_find_long(ap *par, const char *name, size_t len) {
+  ap_index *idx = par->index;
+  size_t i = ap_hash(name, len) & idx->long_mask;
+  for (; idx->longs[i]; i = (i + 1) & idx->long_mask) {
+    const ap_rec *rec = idx->recs + idx->longs[i] - 1;
+    if (rec->len == len && !memcmp(rec->name, name, len))
+      return rec;
+  }
+  return NULL;
+}
+
+const ap_rec *ap_find_short(ap *par, char opt_short) {
+  int i = par->index->shorts[(unsigned char)opt_short];
+  return i ? par->index->recs + i - 1 : NULL;
+}
+
+ap_sub *ap_find_sub(ap *par, ap_arg *arg, const char *name, size_t len) {
+  ap_index *idx = par->index;
+  size_t i = ap_hash(name, len) & idx->sub_mask;
+  for (; idx->subs[i]; i = (i + 1) & idx->sub_mask) {
+    ap_sub_rec *rec = idx->sub_recs + idx->subs[i] - 1;
+    if (rec->arg == arg && rec->len == len && !memcmp(rec->name, name, len))
+      return rec->sub;
+  }
+  return NULL;
+}
+
+typedef struct ap_parser {
+  int argc;
+  const char *const *argv; /* NUL-terminated arguments (NULL if views) */
+  const ap_view *views;    /* length-delimited arguments (NULL if argv) */
+  const char *arg;         /* current argument */
+  int idx;
+  int arg_idx;
+  int arg_len;
+  int attached;        /* 1 if at the (maybe empty) value of a "--name=value" */
+  void *base;          /* base pointer passed to callbacks */
+  ap_session *session; /* session being parsed in (NULL if none) */
+} ap_parser;
+
+/* load the argument at `ctx->idx` */
+void ap_parser_load(ap_parser *ctx) {
+  if (ctx->idx == ctx->argc) {
+    ctx->arg = NULL;
+    ctx->arg_len = 0;
+  } else if (ctx->views) {
+    /* if this fails, a view is too long */
+    assert(ctx->views[ctx->idx].len <= INT_MAX);
+    ctx->arg = ctx->views[ctx->idx].ptr;
+    ctx->arg_len = (int)ctx->views[ctx->idx].len;
+  } else {
+    ctx->arg = ctx->argv[ctx->idx];
+    ctx->arg_len = (int)strlen(ctx->arg);
+  }
+}
+
+void ap_parser_init(
+    ap_parser *ctx, int argc, const char *const *argv, const ap_view *views) {
+  ctx->argc = argc;
+  ctx->argv = argv;
+  ctx->views = views;
+  ctx->idx = 0;
+  ctx->arg_idx = 0;
+  ctx->attached = 0;
+  ctx->base = NULL;
+  ctx->session = NULL;
+  ap_parser_load(ctx);
+}
+
+void ap_parser_advance(ap_parser *ctx, int amt) {
+  if (!amt)
+    return;
   /* if this fails, you tried to run the parser backwards. this isn't possible
    * at the moment. */
   assert(amt > 0);
@@ -546,31 +2489,44 @@ void ap_parser_advance(ap_parser *ctx, int amt) {
   if (ctx->arg_idx == ctx->arg_len) {
     ctx->idx++;
     ctx->arg_idx = 0;
-    ctx->arg_len =
-        (ctx->idx == ctx->argc) ? 0 : (int)strlen(ctx->argv[ctx->idx]);
+    ap_parser_load(ctx);
   }
 }
 
 const char *ap_parser_cur(ap_parser *ctx) {
   return (ctx->idx == ctx->argc || ctx->arg_idx == ctx->arg_len)
              ? NULL
-             : ctx->argv[ctx->idx] + ctx->arg_idx;
+             : ctx->arg + ctx->arg_idx;
 }
 
 int ap_parse_internal(ap *par, ap_parser *ctx);
 
-int ap_parse_internal_part(ap *par, ap_arg *arg, ap_parser *ctx) {
+int ap_parse_internal_part(ap *par, const ap_rec *rec, ap_parser *ctx) {
   int cb_ret, cb_sub_idx = 0;
-  if (!(arg->flags & AP_ARG_FLAG_SUB)) {
+  void *user = rec->user;
+  if (rec->flags & AP_ARG_FLAG_AT) {
+    /* if this fails, an argument is bound to an offset, but you didn't pass
+     * a base pointer with ap_parse_into or ap_session_reset */
+    assert(ctx->base);
+    user = (char *)ctx->base + rec->offset;
+  }
+  if (rec->flags & AP_ARG_FLAG_BIT) {
+    /* bit flags take no argument, and everything they need is in `rec` */
+    *(unsigned long *)user |= rec->mask;
+  } else if (!(rec->flags & AP_ARG_FLAG_SUB)) {
     ap_cb_data cbd = {0};
     do {
-      cbd.arg = ap_parser_cur(ctx);
-      cbd.arg_len = cbd.arg ? ctx->arg_len : 0;
+      /* an attached value is passed even if it's empty */
+      cbd.arg = ctx->attached ? ctx->arg + ctx->arg_idx : ap_parser_cur(ctx);
+      cbd.arg_len = cbd.arg ? ctx->arg_len - ctx->arg_idx : 0;
+      ctx->attached = 0;
       cbd.idx = cb_sub_idx++;
       cbd.more = 0;
-      cbd.reserved = arg;
+      cbd.reserved = rec->arg;
       cbd.parser = par;
-      cb_ret = arg->cb(arg->user, &cbd);
+      cbd.base = ctx->base;
+      cbd.session = ctx->session;
+      cb_ret = rec->cb(user, &cbd);
       if (cb_ret < 0)
         /* callback encountered error in parse */
         return cb_ret;
@@ -580,27 +2536,28 @@ int ap_parse_internal_part(ap *par, ap_arg *arg, ap_parser *ctx) {
       ap_parser_advance(ctx, cb_ret);
     } while (cbd.more);
   } else {
-    ap_sub *sub = arg->user;
+    ap_sub *sub = rec->user;
     /* if this fails, then you forgot to call ap_sub_add */
     assert(sub);
-    if (!sub->identifier) {
-      /* immediately trigger parsing */
-      return ap_parse_internal(sub->par, ctx);
-    } else {
+    if (sub->identifier) {
       const char *cmp = ap_parser_cur(ctx);
-      if (!cmp)
+      int len = ctx->arg_len - ctx->arg_idx;
+      if (!cmp || !(sub = ap_find_sub(par, rec->arg, cmp, (size_t)len)))
+        /* (error) couldn't find subparser */
         return AP_ERR_PARSE;
-      while (sub) {
-        if (!strcmp(sub->identifier, cmp))
-          goto found;
-        sub = sub->next;
-      }
-      /* (error) couldn't find subparser */
-      return AP_ERR_PARSE;
-    found:
-      ap_parser_advance(ctx, (int)strlen(sub->identifier));
-      return ap_parse_internal(sub->par, ctx);
+      ap_parser_advance(ctx, len);
+      ctx->attached = 0;
+    } /* else, immediately trigger parsing */
+    if (!sub->par) {
+      int err;
+      if ((err = ap_sub_build(par, sub)))
+        return err;
     }
+    if (rec->flags & AP_ARG_FLAG_AT)
+      *(int *)user = sub->idx;
+    else if (rec->arg->user1)
+      *(int *)rec->arg->user1 = sub->idx;
+    return ap_parse_internal(sub->par, ctx);
   }
   return AP_ERR_NONE;
 }
@@ -612,85 +2569,72 @@ ap_arg *ap_find_next_positional(ap_arg *arg) {
   return arg;
 }
 
-typedef struct ap_iter {
-  ap_arg *arg;
-  ap *parent;
-} ap_iter;
-
-ap_iter ap_iter_init(ap *parent) {
-  ap_iter out;
-  while (parent && !parent->args)
-    parent = parent->parent;
-  out.arg = parent ? parent->args : NULL;
-  out.parent = parent;
-  return out;
-}
-
-void ap_iter_next(ap_iter *iter) {
-  assert(iter->arg);
-  if (!(iter->arg = iter->arg->next))
-    *iter = ap_iter_init(iter->parent->parent);
-}
-
 int ap_parse_internal(ap *par, ap_parser *ctx) {
   int err;
   ap_arg *next_positional = ap_find_next_positional(par->args);
+  if ((err = ap_index_ensure(par)))
+    return err;
   while (ctx->idx < ctx->argc) {
-    if (ap_parser_cur(ctx)[0] == '-' &&
-        (ap_parser_cur(ctx)[1] && ap_parser_cur(ctx)[1] != '-')) {
+    /* arguments are length-delimited and may be empty, so check lengths
+     * before looking at their chars */
+    const char *cur = ctx->arg;
+    int len = ctx->arg_len;
+    if (len >= 2 && cur[0] == '-' && cur[1] != '-') {
       /* optional "-O..." */
       int saved_idx = ctx->idx;
       ap_parser_advance(ctx, 1);
-      while (ctx->idx == saved_idx && ap_parser_cur(ctx) &&
-             *ap_parser_cur(ctx)) {
+      while (ctx->idx == saved_idx && ap_parser_cur(ctx)) {
         /* accumulate chained short opts */
-        ap_iter iter;
-        char opt_short = *ap_parser_cur(ctx);
-        for (iter = ap_iter_init(par); iter.arg; ap_iter_next(&iter)) {
-          ap_arg *search = iter.arg;
-          if ((search->flags & AP_ARG_FLAG_OPT) &&
-              search->opt_short == opt_short) {
-            /* found arg with matching short opt */
-            /* step over option char */
-            ap_parser_advance(ctx, 1);
-            if ((err = ap_parse_internal_part(par, search, ctx)) < 0)
-              return err;
-            /* if this fails, your callback advanced to the next argument, but
-             * did not fully consume that argument */
-            assert(ctx->idx != saved_idx ? !ctx->arg_idx : 1);
-            break;
-          }
-        }
-        if (!iter.arg)
+        const ap_rec *search = ap_find_short(par, *ap_parser_cur(ctx));
+        if (!search)
           /* arg not found */
           return AP_ERR_PARSE;
-        /* arg found and parsing must continue */
-        continue;
+        /* found arg with matching short opt, step over option char */
+        ap_parser_advance(ctx, 1);
+        if ((err = ap_parse_internal_part(par, search, ctx)) < 0)
+          return err;
+        /* if this fails, your callback advanced to the next argument, but did
+         * not fully consume that argument */
+        assert(ctx->idx != saved_idx ? !ctx->arg_idx : 1);
       }
-    } else if (ap_parser_cur(ctx)[0] == '-' && ap_parser_cur(ctx)[1] == '-' &&
-               ap_parser_cur(ctx)[2]) {
-      /* long optional "--option..."*/
-      ap_iter iter;
+    } else if (len >= 3 && cur[0] == '-' && cur[1] == '-') {
+      /* long optional "--option..." or "--option=value" */
+      const ap_rec *search;
+      const char *eq = memchr(cur + 2, '=', (size_t)len - 2);
+      int prev_idx = ctx->idx, name_len = (eq ? (int)(eq - cur) : len) - 2;
       ap_parser_advance(ctx, 2);
-      for (iter = ap_iter_init(par); iter.arg; ap_iter_next(&iter)) {
-        ap_arg *search = iter.arg;
-        if ((search->flags & AP_ARG_FLAG_OPT) &&
-            !strcmp(search->opt_long, ap_parser_cur(ctx))) {
-          /* found arg with matching long opt */
-          int prev_idx = ctx->idx;
-          /* step over long opt name */
-          ap_parser_advance(ctx, (int)strlen(search->opt_long));
-          if ((err = ap_parse_internal_part(par, search, ctx)) < 0)
-            return err;
-          /* if this fails, your callback did not consume every character of the
-           * argument (it returned a value less than the argument length) */
-          assert(ctx->idx != prev_idx);
-          break;
-        }
-      }
-      if (!iter.arg)
+      if (!(search = ap_find_long(par, ap_parser_cur(ctx), (size_t)name_len)))
         /* arg not found */
         return AP_ERR_PARSE;
+      /* found arg with matching long opt, step over long opt name */
+      if (eq) {
+        if (search->flags & AP_ARG_FLAG_NOVALUE)
+          /* reject the value before the callback acts on the option */
+          return ap_arg_error_internal(
+              par, ctx->session, search->arg, "unexpected value");
+        /* step over the '=' too, but stay in this argument: the value is
+         * handed to the callback in place, even if it's empty */
+        ap_parser_advance(ctx, name_len);
+        ctx->arg_idx++;
+        ctx->attached = 1;
+      } else {
+        ap_parser_advance(ctx, name_len);
+      }
+      if ((err = ap_parse_internal_part(par, search, ctx)) < 0)
+        return err;
+      if (eq && ctx->idx == prev_idx) {
+        if (ctx->arg_idx != ctx->arg_len)
+          /* the callback took no value, or only part of it */
+          return ap_arg_error_internal(
+              par, ctx->session, search->arg, "unexpected value");
+        /* the value was empty, move on to the next argument */
+        ctx->idx++;
+        ctx->arg_idx = 0;
+        ap_parser_load(ctx);
+      }
+      /* if this fails, your callback did not consume every character of the
+       * argument (it returned a value less than the argument length) */
+      assert(ctx->idx != prev_idx);
       /* arg found and parsing must continue */
       continue;
     } else if (!next_positional) {
@@ -699,7 +2643,9 @@ int ap_parse_internal(ap *par, ap_parser *ctx) {
     } else {
       /* positional, includes "-" and "--" and "" */
       int part_ret = 0, prev_idx = ctx->idx;
-      if ((part_ret = ap_parse_internal_part(par, next_positional, ctx)) < 0)
+      ap_rec rec;
+      ap_rec_init(&rec, next_positional);
+      if ((part_ret = ap_parse_internal_part(par, &rec, ctx)) < 0)
         return part_ret;
       /* if this fails, your callback did not consume every character of the
        * argument (it returned a value less than the argument length) */
@@ -708,62 +2654,316 @@ int ap_parse_internal(ap *par, ap_parser *ctx) {
     }
   }
   if (next_positional)
-    return ap_arg_error_internal(par, next_positional, "expected an argument");
+    return ap_arg_error_internal(
+        par, ctx->session, next_positional, "expected an argument");
   return AP_ERR_NONE;
 }
 
 int ap_parse(ap *par, int argc, const char *const *argv) {
   ap_parser parser;
-  ap_parser_init(&parser, argc, argv);
+  ap_parser_init(&parser, argc, argv, NULL);
   return ap_parse_internal(par, &parser);
 }
 
-int ap_show_usage(ap *par) { return ap_usage(par, ap_cb_out); }
+int ap_parse_views(ap *par, int argc, const ap_view *argv) {
+  ap_parser parser;
+  ap_parser_init(&parser, argc, NULL, argv);
+  return ap_parse_internal(par, &parser);
+}
 
-int ap_show_help(ap *par) {
-  int err = AP_ERR_NONE;
-  if ((err = ap_show_usage(par)))
-    return err;
-  if ((err = ap_pstrs(par, ap_cb_out, "\n")))
-    return err;
-  if (par->description &&
-      (err = ap_pstrs(par, ap_cb_out, "\n%s\n", par->description)))
+int ap_parse_into(ap *par, void *base, int argc, const char *const *argv) {
+  ap_parser parser;
+  ap_parser_init(&parser, argc, argv, NULL);
+  parser.base = base;
+  return ap_parse_internal(par, &parser);
+}
+
+int ap_session_begin(ap_session **out, ap *par) {
+  ap_session *sess;
+  /* if this fails, you didn't call ap_compile, so parsing could still modify
+   * the parser */
+  assert(par->frozen);
+  if (!(sess = ap_cb_malloc(par, sizeof(*sess))))
+    return AP_ERR_NOMEM;
+  sess->par = par;
+  ap_session_reset(sess, NULL);
+  *out = sess;
+  return AP_ERR_NONE;
+}
+
+void ap_session_reset(ap_session *sess, void *base) {
+  sess->base = base;
+  sess->err_par = NULL;
+  sess->err_arg = NULL;
+  sess->err_msg[0] = '\0';
+}
+
+/* parse in a session, from either argv or views */
+int ap_session_run(
+    ap_session *sess, int argc, const char *const *argv, const ap_view *views) {
+  ap_parser parser;
+  /* errors are only ever about the last parse */
+  sess->err_par = NULL;
+  ap_parser_init(&parser, argc, argv, views);
+  parser.base = sess->base;
+  parser.session = sess;
+  return ap_parse_internal(sess->par, &parser);
+}
+
+int ap_session_parse(ap_session *sess, int argc, const char *const *argv) {
+  return ap_session_run(sess, argc, argv, NULL);
+}
+
+int ap_session_parse_views(ap_session *sess, int argc, const ap_view *argv) {
+  return ap_session_run(sess, argc, NULL, argv);
+}
+
+size_t ap_session_error(const ap_session *sess, char *buf, size_t size) {
+  ap_out out;
+  ap_out_init_buf(&out, sess->par, buf, size);
+  if (sess->err_par)
+    ap_arg_error_render(sess->err_par, &out, sess->err_arg, sess->err_msg);
+  return ap_out_end_buf(&out);
+}
+
+void ap_session_end(ap_session *sess) {
+  ap_cb_free(sess->par, sess, sizeof(*sess));
+}
+
+/* a worker of a batch, parsing records [first, last) in its own session */
+typedef struct ap_batch_worker {
+  ap_session sess;
+  const ap_batch *batch;
+  int first, last;
+  int failed; /* number of records that failed */
+} ap_batch_worker;
+
+void ap_batch_work(void *arg, int i) {
+  ap_batch_worker *w = (ap_batch_worker *)arg + i;
+  const ap_batch *b = w->batch;
+  char *base = (char *)b->results;
+  int r, res;
+  for (r = w->first; r < w->last; r++) {
+    ap_session_reset(&w->sess, base ? base + b->result_size * (size_t)r : NULL);
+    res = ap_session_parse(&w->sess, b->cmds[r].argc, b->cmds[r].argv);
+    if (b->status)
+      b->status[r] = res;
+    w->failed += !!res;
+  }
+}
+
+int ap_parse_batch(ap *par, const ap_batch *batch) {
+  ap_batch_worker *workers;
+  int i, nworkers = batch->nworkers, failed = 0;
+  /* if this fails, you didn't call ap_compile, so the workers could modify
+   * the parser */
+  assert(par->frozen);
+  if (nworkers > batch->n)
+    nworkers = batch->n;
+  if (nworkers < 1 || !batch->runner)
+    nworkers = 1;
+  /* every worker is set up here, so that workers never allocate */
+  if (!(workers = ap_cb_malloc(par, sizeof(*workers) * (size_t)nworkers)))
+    return AP_ERR_NOMEM;
+  for (i = 0; i < nworkers; i++) {
+    workers[i].sess.par = par;
+    ap_session_reset(&workers[i].sess, NULL);
+    workers[i].batch = batch;
+    workers[i].first = (int)((long)batch->n * i / nworkers);
+    workers[i].last = (int)((long)batch->n * (i + 1) / nworkers);
+    workers[i].failed = 0;
+  }
+  if (batch->runner)
+    batch->runner(batch->runner_uptr, nworkers, ap_batch_work, workers);
+  else
+    ap_batch_work(workers, 0);
+  for (i = 0; i < nworkers; i++)
+    failed += workers[i].failed;
+  ap_cb_free(par, workers, sizeof(*workers) * (size_t)nworkers);
+  return failed;
+}
+
+/* print text through the cache `t` */
+int ap_show_text(ap *par, ap_text *t, ap_render_func render) {
+  int err;
+  ap_out out;
+  if (!ap_text_ensure(par, t, render))
+    /* one call for the whole text */
+    return ap_print(par, AP_FD_OUT, t->text, t->len);
+  ap_out_init(&out, par, AP_FD_OUT);
+  if ((err = render(par, &out)))
     return err;
-  {
-    int any = 0;
-    ap_arg *arg;
-    for (arg = par->args; arg; arg = arg->next) {
-      /* positional arguments */
-      if (arg->flags & AP_ARG_FLAG_OPT)
-        continue;
-      if (!(any++) &&
-          (err = ap_pstrs(par, ap_cb_out, "\npositional arguments:\n")))
+  return ap_out_flush(&out);
+}
+
+int ap_show_usage(ap *par) {
+  return ap_show_text(par, &par->usage, ap_usage);
+}
+
+/* column help text starts at in the aligned layout, at most */
+#define AP_HELP_MAX_COL 24
+
+/* help text in the aligned layout is wrapped to at least this many chars */
+#define AP_HELP_MIN_WRAP 20
+
+int ap_out_pad(ap_out *out, size_t n) {
+  static const char spaces[] = "                ";
+  int err;
+  while (n) {
+    size_t k = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+    if ((err = ap_out_write(out, spaces, k)))
+      return err;
+    n -= k;
+  }
+  return AP_ERR_NONE;
+}
+
+/* write `text` word-wrapped to `width` chars per line, and end the line;
+ * lines after the first are indented by `indent` */
+int ap_wrap(ap_out *out, const char *text, size_t indent, size_t width) {
+  int err;
+  size_t col = 0; /* chars on the current line */
+  while (*text) {
+    const char *word;
+    size_t len;
+    if (*text == ' ') {
+      text++;
+      continue;
+    }
+    if (*text == '\n') {
+      /* explicit line break */
+      if ((err = ap_out_write(out, "\n", 1)) || (err = ap_out_pad(out, indent)))
         return err;
-      if ((err = ap_pstrs(par, ap_cb_out, "  ")) ||
-          (err = ap_show_argspec(par, arg, ap_cb_out, 1)) ||
-          (err = ap_pstrs(par, ap_cb_out, "\n")))
+      text++, col = 0;
+      continue;
+    }
+    for (word = text; *text && *text != ' ' && *text != '\n'; text++)
+      ;
+    len = (size_t)(text - word);
+    if (col && col + 1 + len > width) {
+      /* words longer than a line still get a line of their own */
+      if ((err = ap_out_write(out, "\n", 1)) || (err = ap_out_pad(out, indent)))
         return err;
-      if (arg->help && (err = ap_pstrs(par, ap_cb_out, "    %s\n", arg->help)))
+      col = 0;
+    } else if (col && (err = ap_out_write(out, " ", 1)))
+      return err;
+    if ((err = ap_out_write(out, word, len)))
+      return err;
+    col += len + !!col;
+  }
+  return ap_out_write(out, "\n", 1);
+}
+
+size_t ap_argspec_len(ap *par, ap_arg *arg) {
+  ap_out out;
+  ap_out_init_mem(&out, par, NULL, 0);
+  ap_show_argspec(&out, arg, 1);
+  return out.total;
+}
+
+/* show the help for positionals (`opt` = 0) or optionals (`opt` = 1) */
+int ap_help_args(ap *par, ap_out *out, int opt, size_t col) {
+  int err, any = 0;
+  ap_arg *arg;
+  size_t width = (size_t)par->help_width;
+  for (arg = par->args; arg; arg = arg->next) {
+    size_t len, start;
+    if (!(arg->flags & AP_ARG_FLAG_OPT) != !opt)
+      continue;
+    /* if this fails, an optional argument has neither a short nor long opt */
+    assert(!opt || arg->opt_long || arg->opt_short);
+    if (!(any++) &&
+        (err = ap_pstrs(out, opt ? "\noptional arguments:\n"
+                                 : "\npositional arguments:\n")))
+      return err;
+    start = out->total;
+    if ((err = ap_pstrs(out, "  ")) || (err = ap_show_argspec(out, arg, 1)))
+      return err;
+    if (!width) {
+      /* classic layout: help on its own line */
+      if ((err = ap_pstrs(out, "\n")) ||
+          (arg->help && (err = ap_pstrs(out, "    %s\n", arg->help))))
         return err;
+      continue;
     }
-    any = 0;
-    for (arg = par->args; arg; arg = arg->next) {
-      /* optional arguments */
-      if (!(arg->flags & AP_ARG_FLAG_OPT))
-        continue;
-      assert(arg->opt_long || arg->opt_short);
-      if (!(any++) &&
-          (err = ap_pstrs(par, ap_cb_out, "\noptional arguments:\n")))
-        return err;
-      if ((err = ap_pstrs(par, ap_cb_out, "  ")) ||
-          (err = ap_show_argspec(par, arg, ap_cb_out, 1)) ||
-          (err = ap_pstrs(par, ap_cb_out, "\n")))
+    /* the argspec was just written, so its length is already known */
+    len = out->total - start;
+    if (!arg->help) {
+      if ((err = ap_pstrs(out, "\n")))
         return err;
-      if (arg->help && (err = ap_pstrs(par, ap_cb_out, "    %s\n", arg->help)))
+      continue;
+    }
+    if (len + 2 > col) {
+      /* argspec is too long, start help on the next line */
+      if ((err = ap_pstrs(out, "\n")))
         return err;
+      len = 0;
     }
+    if ((err = ap_out_pad(out, col - len)) ||
+        (err = ap_wrap(out, arg->help, col,
+                       width > col + AP_HELP_MIN_WRAP ? width - col
+                                                      : AP_HELP_MIN_WRAP)))
+      return err;
   }
-  if (par->epilog && (err = ap_pstrs(par, ap_cb_out, "\n%s\n", par->epilog)))
+  return AP_ERR_NONE;
+}
+
+/* show the description or epilog, if any */
+int ap_help_para(ap *par, ap_out *out, const char *text) {
+  int err;
+  if (!text)
+    return AP_ERR_NONE;
+  if (!par->help_width)
+    return ap_pstrs(out, "\n%s\n", text);
+  if ((err = ap_pstrs(out, "\n")))
     return err;
-  return err;
+  return ap_wrap(out, text, 0, (size_t)par->help_width);
+}
+
+int ap_help_render(ap *par, ap_out *out) {
+  int err = AP_ERR_NONE;
+  size_t col = 0, width = (size_t)par->help_width;
+  ap_arg *arg;
+  if (width)
+    /* measure every argspec once to find the help column */
+    for (arg = par->args; arg; arg = arg->next) {
+      size_t len = 2 + ap_argspec_len(par, arg) + 2;
+      if (len > col)
+        col = len > AP_HELP_MAX_COL ? AP_HELP_MAX_COL : len;
+    }
+  if ((err = ap_text_write(par, &par->usage, ap_usage, out)) ||
+      (err = ap_pstrs(out, "\n")) ||
+      (err = ap_help_para(par, out, par->description)) ||
+      (err = ap_help_args(par, out, 0, col)) ||
+      (err = ap_help_args(par, out, 1, col)) ||
+      (err = ap_help_para(par, out, par->epilog)))
+    return err;
+  return AP_ERR_NONE;
+}
+
+int ap_show_help(ap *par) {
+  return ap_show_text(par, &par->help, ap_help_render);
+}
+
+size_t ap_render_usage(ap *par, char *buf, size_t size) {
+  ap_out out;
+  ap_out_init_buf(&out, par, buf, size);
+  ap_text_write(par, &par->usage, ap_usage, &out);
+  return ap_out_end_buf(&out);
+}
+
+size_t ap_render_help(ap *par, char *buf, size_t size) {
+  ap_out out;
+  ap_out_init_buf(&out, par, buf, size);
+  ap_text_write(par, &par->help, ap_help_render, &out);
+  return ap_out_end_buf(&out);
+}
+
+size_t ap_render_error(
+    ap *par, const char *error_string, char *buf, size_t size) {
+  ap_out out;
+  ap_out_init_buf(&out, par, buf, size);
+  ap_error_prefix(par, &out);
+  ap_pstrs(&out, "%s\n", error_string);
+  return ap_out_end_buf(&out);
 }
@@ -1,6 +1,7 @@
 #ifndef APARSE_H
 #define APARSE_H
 
+#include <limits.h> /* ULONG_MAX */
 #include <stddef.h> /* size_t */
 
 #define AP_ERR_NONE 0   /* no error */
@@ -10,6 +11,26 @@
 #define AP_ERR_EXIT -4  /* exit main() immediately for -h and -v-like opts */
 
 typedef struct ap ap;
+typedef struct ap_session ap_session;
+
+/* 64-bit integers for `ap_type_int64`, sizes, durations and rates; the same
+ * type whatever language mode the library and its users are compiled in */
+#if ULONG_MAX >> 31 >> 31 >= 3
+typedef long ap_int64;
+typedef unsigned long ap_uint64;
+#elif defined(_MSC_VER)
+typedef __int64 ap_int64;
+typedef unsigned __int64 ap_uint64;
+#elif defined(__GNUC__)
+/* `long long` is C99, but GCC and Clang accept it in C89 as an extension */
+__extension__ typedef long long ap_int64;
+__extension__ typedef unsigned long long ap_uint64;
+#elif defined(ULLONG_MAX)
+typedef long long ap_int64;
+typedef unsigned long long ap_uint64;
+#else
+#error "aparse needs a 64-bit integer type"
+#endif
 
 /* "file descriptors" passed to ap_ctxcb->print */
 #define AP_FD_OUT 0 /* stdout */
@@ -30,15 +51,24 @@ typedef struct ap_ctxcb {
   int (*print)(void *uptr, int fd, const char *text, size_t size);
 } ap_ctxcb;
 
+/* a string given by pointer and length, not necessarily NUL-terminated */
+typedef struct ap_view {
+  const char *ptr;
+  size_t len;
+} ap_view;
+
 /* callback data passed to argument callbacks */
 typedef struct ap_cb_data {
-  const char *arg; /* pointer to argument (may be NULL)*/
-  int arg_len;     /* strlen() of arg */
+  const char *arg; /* pointer to argument (may be NULL, may not be
+                    * NUL-terminated if parsing with `ap_parse_views`) */
+  int arg_len;     /* length of arg */
   int idx;         /* number of times callback has been called in a row */
   int more;        /* set this to 1 to have your callback called again */
   int destroy;     /* 1 if ap_custom_dtor() was called arg being destroyed */
   ap *parser;      /* pointer to the parser */
   void *reserved;
+  void *base;          /* base pointer of the session (NULL if none) */
+  ap_session *session; /* session being parsed in (NULL if none) */
 } ap_cb_data;
 
 /* callback function for custom argument types
@@ -65,6 +95,20 @@ ap *ap_init(const char *progname);
  * etc.)*/
 int ap_init_full(ap **out, const char *progname, const ap_ctxcb *pctxcb);
 
+/* initialize parser in arena mode
+ * - out: set to the parser
+ * - progname: argv[0]
+ * - pctxcb: library callbacks (see `ap_ctxcb`)
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * Like `ap_init_full`, but every node of the parser tree (arguments,
+ * subparsers, lookup tables...) is carved out of a few large chunks obtained
+ * from `pctxcb->alloc`, instead of being allocated separately. Nothing is
+ * returned to the allocator until `ap_destroy` releases all chunks at once. */
+int ap_init_arena(ap **out, const char *progname, const ap_ctxcb *pctxcb);
+
 /* destroy parser
  * - parser: the parser to destroy */
 void ap_destroy(ap *parser);
@@ -79,6 +123,17 @@ void ap_description(ap *parser, const char *description);
  * - epilog: the epilog to set */
 void ap_epilog(ap *parser, const char *epilog);
 
+/* set the width help text is laid out for
+ * - parser: the parser to set the help width of
+ * - width: number of columns to wrap help text to, 0 for the classic layout,
+ *          or a negative value to use the `COLUMNS` environment variable (or
+ *          80 if it isn't set)
+ *
+ * With a nonzero width, the help of each argument is aligned in a column
+ * next to its argspec, and it and the description and epilog are
+ * word-wrapped to the width. Subparsers added afterwards inherit the width. */
+void ap_help_width(ap *parser, int width);
+
 /* begin positional argument
  * - parser: the parser to add a positional argument to
  * - metavar: the placeholder text for this argument (required)
@@ -105,17 +160,240 @@ int ap_opt(ap *parser, char short_opt, const char *long_opt);
  *        in argv */
 void ap_type_flag(ap *parser, int *out);
 
+/* bit flag sets: arrays of `AP_FLAG_WORDS(n)` words holding `n` flags */
+#define AP_FLAG_WORD_BITS (sizeof(unsigned long) * 8)
+#define AP_FLAG_WORDS(n) (((n) + AP_FLAG_WORD_BITS - 1) / AP_FLAG_WORD_BITS)
+#define AP_FLAG_WORD(bit) ((bit) / AP_FLAG_WORD_BITS)
+#define AP_FLAG_MASK(bit) (1UL << ((bit) % AP_FLAG_WORD_BITS))
+#define AP_FLAG_TEST(words, bit)                                               \
+  (!!((words)[AP_FLAG_WORD(bit)] & AP_FLAG_MASK(bit)))
+
+/* specify current argument as bit flag type argument
+ * - parser: the parser to set the argument type of
+ * - words: bit flag set that bit `bit` will be set in when argument is
+ *          specified in argv
+ * - bit: the bit of this flag, counting from 0
+ *
+ * The parser sets the bit itself, without a callback, so chains like
+ * "-abcdefgh" cost a table lookup per flag. Flags that share a word can be
+ * tested together with one mask, like
+ * `(words[0] & (AP_FLAG_MASK(1) | AP_FLAG_MASK(2)))`. */
+void ap_type_flag_bit(ap *parser, unsigned long *words, int bit);
+
 /* specify current argument as integer type argument
  * - parser: the parser to set the argument type of
  * - out: pointer to an integer that will be set to the integer value of the
  *        argument specified in argv */
 void ap_type_int(ap *parser, int *out);
 
+/* specify current argument as 64-bit integer type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to an integer that will be set to the integer value of the
+ *        argument specified in argv */
+void ap_type_int64(ap *parser, ap_int64 *out);
+
+/* specify current argument as unsigned integer type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to an integer that will be set to the integer value of the
+ *        argument specified in argv */
+void ap_type_uint(ap *parser, unsigned *out);
+
+/* specify current argument as range-checked integer type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to an integer that will be set to the integer value of the
+ *        argument specified in argv
+ * - min: smallest accepted value
+ * - max: largest accepted value
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * All integer types accept decimal, hexadecimal ("0x"), octal ("0o" or a
+ * leading "0") and binary ("0b") numbers with an optional sign, and reject
+ * trailing characters and values that don't fit. */
+int ap_type_int_range(ap *parser, int *out, int min, int max);
+
+/* specify current argument as a range-checked integer type argument, like
+ * `ap_type_int_range`, but bound to `offset` from the base pointer of each
+ * parse (see `ap_type_flag_at`) */
+int ap_type_int_range_at(ap *parser, size_t offset, int min, int max);
+
+/* specify current argument as double type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to a double that will be set to the value of the argument
+ *        specified in argv
+ *
+ * Accepts decimal numbers with an optional sign, fraction and exponent (like
+ * "-1.5e3") regardless of locale, rounded correctly, and rejects trailing
+ * characters and numbers too large to represent. */
+void ap_type_double(ap *parser, double *out);
+
+/* specify current argument as float type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to a float that will be set to the value of the argument
+ *        specified in argv
+ *
+ * See `ap_type_double`. */
+void ap_type_float(ap *parser, float *out);
+
+/* specify current argument as size type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to an integer that will be set to the number of bytes
+ *        specified in argv
+ *
+ * Sizes are a number, optionally with a fraction, followed by an optional SI
+ * (k, M, G, T, P, E: powers of 1000) or IEC (Ki, Mi, Gi...: powers of 1024)
+ * prefix and an optional "B", like "512MiB" or "1.5G". Prefixes and "B" are
+ * case-insensitive. */
+void ap_type_size(ap *parser, ap_uint64 *out);
+
+/* specify current argument as duration type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to an integer that will be set to the number of nanoseconds
+ *        specified in argv
+ *
+ * Durations are a number, optionally with a fraction, followed by one of the
+ * units ns, us, ms, s, m, h or d (seconds if omitted), like "250ms". */
+void ap_type_duration(ap *parser, ap_uint64 *out);
+
+/* specify current argument as rate type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to an integer that will be set to the number of events per
+ *        second specified in argv
+ *
+ * Rates are written like sizes, optionally followed by "/s", like "10k/s". */
+void ap_type_rate(ap *parser, ap_uint64 *out);
+
 /* specify current argument as string type argument
  * - parser: the parser to set the argument type of
- * - out: pointer to a string that will be set to argument specified in argv */
+ * - out: pointer to a string that will be set to argument specified in argv
+ *
+ * When parsing with `ap_parse_views`, the string is only NUL-terminated if the
+ * view it points into is; use `ap_type_view` instead. */
 void ap_type_str(ap *parser, const char **out);
 
+/* specify current argument as string view type argument
+ * - parser: the parser to set the argument type of
+ * - out: pointer to a view that will be set to the argument specified in argv
+ *        (the view points into argv) */
+void ap_type_view(ap *parser, ap_view *out);
+
+/* specify current argument as a flag, number, string or view type argument
+ * that's bound to an offset, like the types above
+ * - parser: the parser to set the argument type of
+ * - offset: offset of the output from the base pointer of each parse, like
+ *           `offsetof(struct config, threads)`
+ * - bit: (for `ap_type_flag_bit_at`) the bit of the flag in the bit flag set
+ *        at `offset`
+ *
+ * Instead of writing to one fixed output, these write into whatever the base
+ * pointer passed to `ap_parse_into` or `ap_session_reset` points to, so one
+ * parser can fill any number of result structs. */
+void ap_type_flag_at(ap *parser, size_t offset);
+void ap_type_flag_bit_at(ap *parser, size_t offset, int bit);
+void ap_type_int_at(ap *parser, size_t offset);
+void ap_type_int64_at(ap *parser, size_t offset);
+void ap_type_uint_at(ap *parser, size_t offset);
+void ap_type_double_at(ap *parser, size_t offset);
+void ap_type_float_at(ap *parser, size_t offset);
+void ap_type_size_at(ap *parser, size_t offset);
+void ap_type_duration_at(ap *parser, size_t offset);
+void ap_type_rate_at(ap *parser, size_t offset);
+void ap_type_str_at(ap *parser, size_t offset);
+void ap_type_view_at(ap *parser, size_t offset);
+
+/* lists that repeated arguments are appended to; `items` is valid until the
+ * parser is destroyed */
+typedef struct ap_str_list {
+  const char **items; /* the strings specified in argv */
+  size_t len;         /* number of items */
+  size_t cap;         /* number of items there's room for */
+} ap_str_list;
+
+typedef struct ap_int_list {
+  int *items;
+  size_t len;
+  size_t cap;
+} ap_int_list;
+
+typedef struct ap_double_list {
+  double *items;
+  size_t len;
+  size_t cap;
+} ap_double_list;
+
+/* specify current argument as string list type argument
+ * - parser: the parser to set the argument type of
+ * - out: list that every argument specified in argv will be appended to
+ *
+ * The list storage grows geometrically through `ap_ctxcb.alloc` (or inside
+ * the arena, for parsers from `ap_init_arena`), and is freed by
+ * `ap_destroy`. The list isn't cleared between calls to `ap_parse`. */
+void ap_type_str_list(ap *parser, ap_str_list *out);
+
+/* specify current argument as integer list type argument
+ * - parser: the parser to set the argument type of
+ * - out: list that the value of every argument specified in argv will be
+ *        appended to
+ *
+ * See `ap_type_str_list` and `ap_type_int`. */
+void ap_type_int_list(ap *parser, ap_int_list *out);
+
+/* specify current argument as double list type argument
+ * - parser: the parser to set the argument type of
+ * - out: list that the value of every argument specified in argv will be
+ *        appended to
+ *
+ * See `ap_type_str_list` and `ap_type_double`. */
+void ap_type_double_list(ap *parser, ap_double_list *out);
+
+/* specify current argument as delimited integer list type argument
+ * - parser: the parser to set the argument type of
+ * - out: list that the integers in every argument specified in argv will be
+ *        appended to
+ * - delim: the delimiter between integers, like ','
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * Each argument is split on `delim` into decimal integers, like "17,42,99".
+ * If `out->items` is NULL, the list grows like in `ap_type_int_list`.
+ * Otherwise it's a caller-provided array of `out->cap` integers that's never
+ * grown or freed, and arguments with too many integers are errors. */
+int ap_type_int_split(ap *parser, ap_int_list *out, char delim);
+
+/* key=value pair, as slices of an argument specified in argv */
+typedef struct ap_map_entry {
+  ap_view key;
+  ap_view value;
+} ap_map_entry;
+
+/* map that "key=value" arguments are added to; `items` is valid until the
+ * parser is destroyed */
+typedef struct ap_map {
+  ap_map_entry *items; /* entries, in order of each key's first appearance */
+  size_t len;          /* number of entries */
+  size_t cap;          /* number of entries there's room for */
+  size_t *slots;       /* (private) hash table of entry indices + 1 */
+  size_t nslots;       /* (private) number of slots, a power of two */
+} ap_map;
+
+/* specify current argument as key=value map type argument
+ * - parser: the parser to set the argument type of
+ * - out: map that every argument specified in argv will be added to
+ *
+ * Each argument is split on its first '=', so "a.b=c=d" has key "a.b" and
+ * value "c=d". Keys and values point into argv, and a later value for a key
+ * replaces the earlier one. The map is freed by `ap_destroy`. */
+void ap_type_map(ap *parser, ap_map *out);
+
+/* look up a key in a map
+ * - map: the map to search
+ * - key: the key, not necessarily NUL-terminated
+ * - len: length of the key
+ * return: the key's value, or NULL if the key isn't in the map */
+const ap_view *ap_map_get(const ap_map *map, const char *key, size_t len);
+
 /* specify current argument as enum type argument
  * - parser: the parser to set the argument type of
  * - out: pointer to an integer that will hold the index in `choices` of the
@@ -126,6 +404,31 @@ void ap_type_str(ap *parser, const char **out);
  * - AP_ERR_NOMEM: out of memory */
 int ap_type_enum(ap *parser, int *out, const char **choices);
 
+/* flags for `ap_type_enum_ex` */
+#define AP_ENUM_ICASE 0x1  /* match choices ignoring ASCII case */
+#define AP_ENUM_PREFIX 0x2 /* accept any unambiguous prefix of a choice */
+
+/* specify current argument as enum type argument (extended)
+ * - parser: the parser to set the argument type of
+ * - out: pointer to an integer that will hold the index in `choices` of the
+ *        argument specified in argv
+ * - choices: NULL-terminated array of string choices for the argument
+ * - flags: bitset of AP_ENUM_xxx
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * Choices are sorted once here, so matching an argument takes a binary search
+ * instead of a comparison against every choice. If several choices match, the
+ * one with the lowest index wins. */
+int ap_type_enum_ex(ap *parser, int *out, const char **choices, int flags);
+
+/* specify current argument as enum type argument, like `ap_type_enum_ex`, but
+ * bound to `offset` from the base pointer of each parse (see
+ * `ap_type_flag_at`) */
+int ap_type_enum_at(ap *parser, size_t offset, const char **choices,
+                    int flags);
+
 /* specify current argument as one that shows help text immediately
  * - parser: the parser to set the argument type of
  *
@@ -145,6 +448,11 @@ void ap_type_version(ap *parser, const char *version);
  * - out_idx: set to the index of the subparser that was selected for parsing */
 void ap_type_sub(ap *parser, const char *metavar, int *out_idx);
 
+/* specify current argument as subparser, like `ap_type_sub`, but set the index
+ * of the selected subparser at `offset` from the base pointer of each parse
+ * (see `ap_type_flag_at`) */
+void ap_type_sub_at(ap *parser, const char *metavar, size_t offset);
+
 /* add subparser selection to subparser argument
  * - parser: the parser that will have a new subparser added to its current
  *           subparser argument
@@ -159,6 +467,31 @@ void ap_type_sub(ap *parser, const char *metavar, int *out_idx);
  * triggering a subparser immediately on an option specification. */
 int ap_sub_add(ap *parser, const char *name, ap **subpar);
 
+/* callback that builds a lazily-added subparser
+ * - uptr: user pointer
+ * - subpar: the newly-constructed, empty subparser to add arguments to
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_xxx: error occurred */
+typedef int (*ap_sub_builder)(void *uptr, ap *subpar);
+
+/* add lazily-built subparser selection to subparser argument
+ * - parser: the parser that will have a new subparser added to its current
+ *           subparser argument
+ * - name: value specified in `argv` to trigger this subparser
+ * - builder: function called to add arguments to the subparser
+ * - user: user pointer passed to `builder`
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * Like `ap_sub_add`, but the subparser is only constructed, by calling
+ * `builder`, the first time it's selected while parsing (or when the tree is
+ * compiled with `ap_compile`). Errors returned by `builder` are returned from
+ * `ap_parse`. */
+int ap_sub_add_lazy(
+    ap *parser, const char *name, ap_sub_builder builder, void *user);
+
 /* specify current argument as a custom argument
  * - parser: the parser to set the argument type of
  * - callback: function called when this argument is specified in `argv`
@@ -174,6 +507,12 @@ void ap_type_custom(ap *parser, ap_cb callback, void *user);
  *           `ap_cb_data.destroy == 1` when `ap_destroy` is called, 0 if not */
 void ap_custom_dtor(ap *parser, int enable);
 
+/* signal that the current custom argument takes no value, like a flag
+ * - parser: the parser that will have its current argument modified
+ * - enable: 1 if a value attached with "--name=value" should be rejected
+ *           before the callback is called, 0 if it's passed to the callback */
+void ap_custom_novalue(ap *parser, int enable);
+
 /* specify help text for the current argument
  * - parser: the parser to set the help text of the current argument for
  * - help: the help text to set */
@@ -184,6 +523,20 @@ void ap_help(ap *parser, const char *help);
  * - metavar: the metavar to set */
 void ap_metavar(ap *parser, const char *metavar);
 
+/* compile parser into read-only lookup tables
+ * - parser: the root parser to compile, along with all of its subparsers
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * This builds the lookup tables (option records, hash indexes and a pool of
+ * option and command names) of every parser in the tree into one contiguous
+ * block. Without it, tables are built lazily by `ap_parse` and rebuilt after
+ * every change to a parser. Once compiled, the parser tree may no longer be
+ * modified, and parsing never writes to it, so it may be shared between
+ * threads that parse concurrently (argument callbacks permitting). */
+int ap_compile(ap *parser);
+
 /* parse arguments
  * - parser: the parser to use for parsing `argc` and `argv`
  * - argc: the number of arguments in `argv`
@@ -200,6 +553,129 @@ void ap_metavar(ap *parser, const char *metavar);
  * `ap_parse(parser, argc - 1, argv + 1);` */
 int ap_parse(ap *parser, int argc, const char *const *argv);
 
+/* parse length-delimited arguments
+ * - parser: the parser to use for parsing `argc` and `argv`
+ * - argc: the number of arguments in `argv`
+ * - argv: an array of views of the arguments themselves
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_PARSE: parsing error, message was printed using `ap_ctxcb.err`
+ * - AP_ERR_IO: I/O error when writing output
+ * - AP_ERR_EXIT: argument specified exiting early (like -h or -v)
+ *
+ * Like `ap_parse`, but arguments are given as (pointer, length) pairs, so they
+ * don't need to be NUL-terminated and are never measured with `strlen`. Views
+ * may point into a larger buffer, e.g. a command line received over the
+ * network. */
+int ap_parse_views(ap *parser, int argc, const ap_view *argv);
+
+/* parse arguments into a result struct
+ * - parser: the parser to use for parsing `argc` and `argv`
+ * - base: pointer to the results, passed to callbacks as `ap_cb_data.base`
+ * - argc: the number of arguments in `argv`
+ * - argv: the arguments themselves
+ * return: like `ap_parse`
+ *
+ * Arguments defined with `ap_type_xxx_at` write their values at their offset
+ * from `base`; other arguments write to their own outputs as usual. */
+int ap_parse_into(ap *parser, void *base, int argc, const char *const *argv);
+
+/* begin a parse session
+ * - out: pointer to the new session
+ * - parser: the compiled parser to parse with
+ * return:
+ * - AP_ERR_NONE: no error
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * A session holds everything a parse writes to apart from its results, so
+ * any number of sessions can share one parser, including from different
+ * threads. `parser` must have been compiled with `ap_compile`, which makes it
+ * read-only, and outlive the session. Parsing in a session allocates
+ * nothing, unless an argument type does (like lists and maps, which also
+ * aren't safe to share between threads). */
+int ap_session_begin(ap_session **out, ap *parser);
+
+/* prepare a session for the next parse
+ * - session: the session to reset
+ * - base: pointer passed to callbacks as `ap_cb_data.base`, like the start of
+ *         a struct that the results of the parse are written into */
+void ap_session_reset(ap_session *session, void *base);
+
+/* parse arguments in a session
+ * - session: the session to parse in
+ * - argc: the number of arguments in `argv`
+ * - argv: the arguments themselves
+ * return: like `ap_parse`
+ *
+ * Unlike `ap_parse`, error messages aren't printed, but kept in the session
+ * for `ap_session_error`, and help and version arguments return AP_ERR_EXIT
+ * without showing anything. */
+int ap_session_parse(ap_session *session, int argc, const char *const *argv);
+
+/* parse length-delimited arguments in a session; see `ap_session_parse` and
+ * `ap_parse_views` */
+int ap_session_parse_views(ap_session *session, int argc, const ap_view *argv);
+
+/* render the error of the last parse in a session into a buffer
+ * - session: the session whose last parse failed
+ * - buf: buffer to write into (may be NULL if `size` is 0)
+ * - size: size of `buf` in bytes
+ * return: length of the error message, like `ap_render_error`
+ *
+ * The message is empty if the last parse succeeded, or failed without one
+ * (like on an unknown option). */
+size_t ap_session_error(const ap_session *session, char *buf, size_t size);
+
+/* end a parse session, freeing it
+ * - session: the session to end */
+void ap_session_end(ap_session *session);
+
+/* a command line, given like `argc` and `argv` of `ap_parse` */
+typedef struct ap_cmdline {
+  int argc;
+  const char *const *argv;
+} ap_cmdline;
+
+/* job of a batch worker, where `i` is the worker's number */
+typedef void (*ap_batch_job)(void *arg, int i);
+
+/* runs `job(arg, i)` for every `i` in [0, njobs), possibly at the same time
+ * on different threads, and returns once all of them are done */
+typedef void (*ap_batch_runner)(
+    void *uptr, int njobs, ap_batch_job job, void *arg);
+
+/* many command lines to parse with one parser */
+typedef struct ap_batch {
+  const ap_cmdline *cmds; /* the command lines */
+  int n;                  /* number of command lines */
+  void *results;          /* `n` result records, one base pointer per parse
+                           * (see `ap_parse_into`), or NULL */
+  size_t result_size;     /* size of each result record in bytes */
+  int *status;            /* `n` statuses, set to each parse's return value
+                           * (may be NULL) */
+  int nworkers;           /* number of workers to split the batch between */
+  ap_batch_runner runner; /* runs the workers (NULL to parse everything on
+                           * this thread, with one worker) */
+  void *runner_uptr;      /* user pointer passed to `runner` */
+} ap_batch;
+
+/* parse a batch of command lines
+ * - parser: the compiled parser to parse with
+ * - batch: the command lines, and where their results go
+ * return:
+ * - 0 or any positive value: number of command lines that didn't parse
+ * - AP_ERR_NOMEM: out of memory
+ *
+ * The batch is split into `nworkers` contiguous runs, each parsed in its own
+ * session (see `ap_session_begin`), so a failing command line doesn't stop
+ * the rest. Every worker is set up before `runner` is called, and workers
+ * don't allocate. Like in sessions, error messages aren't printed.
+ *
+ * Arguments should be bound to offsets (the `_at` types, and `ap_type_sub_at`
+ * for the selected subcommand): other outputs are shared by every command
+ * line, and written to from several threads at once if `runner` uses them. */
+int ap_parse_batch(ap *parser, const ap_batch *batch);
+
 /* show help text
  * - parser: the parser to show the help text of
  * return:
@@ -214,6 +690,42 @@ int ap_show_help(ap *parser);
  * - AP_ERR_IO: I/O error when writing output */
 int ap_show_usage(ap *parser);
 
+/* render usage text into a buffer
+ * - parser: the parser to render the usage text of
+ * - buf: buffer to write the NUL-terminated text to (may be NULL if `size` is
+ *        0)
+ * - size: size of `buf` in bytes
+ * return:
+ * - the length of the full text, which was truncated if not less than `size`
+ *
+ * Like `snprintf`, so a call with a `size` of 0 measures the text. Rendering
+ * into a buffer never allocates or calls any `ap_ctxcb` callback. */
+size_t ap_render_usage(ap *parser, char *buf, size_t size);
+
+/* render help text into a buffer
+ * - parser: the parser to render the help text of
+ * - buf: buffer to write the NUL-terminated text to (may be NULL if `size` is
+ *        0)
+ * - size: size of `buf` in bytes
+ * return:
+ * - the length of the full text, which was truncated if not less than `size`
+ *
+ * See `ap_render_usage`. */
+size_t ap_render_help(ap *parser, char *buf, size_t size);
+
+/* render an error with usage text into a buffer
+ * - parser: the parser to render the error for
+ * - error_string: the error message
+ * - buf: buffer to write the NUL-terminated text to (may be NULL if `size` is
+ *        0)
+ * - size: size of `buf` in bytes
+ * return:
+ * - the length of the full text, which was truncated if not less than `size`
+ *
+ * Renders the same text `ap_error` displays. See `ap_render_usage`. */
+size_t ap_render_error(
+    ap *parser, const char *error_string, char *buf, size_t size);
+
 /* display an error with usage text
  * - parser: the parser to display the error for
  * - error_string: the error message
@@ -0,0 +1,955 @@
+#include <aparse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* number of tokens parsed per measurement */
+#define BENCH_TOKENS 100000
+
+double bench_elapsed_ns(clock_t start) {
+  return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC;
+}
+
+/* fill `argv` with `ntok` tokens of the form "<prefix><name>" drawn from
+ * `names`, using the strings stored in `storage` */
+void bench_make_argv(
+    const char **argv, char (*storage)[24], int ntok, const char *prefix,
+    char (*names)[16], int nnames) {
+  int i;
+  srand(1);
+  for (i = 0; i < ntok; i++) {
+    sprintf(storage[i], "%s%s", prefix, names[rand() % nnames]);
+    argv[i] = storage[i];
+  }
+}
+
+/* per-token cost of long option lookup as the option count grows */
+int bench_long_opts(void) {
+  static const int counts[] = {10, 100, 1000, 10000};
+  char(*names)[16] = malloc(sizeof(*names) * 10000);
+  char(*storage)[24] = malloc(sizeof(*storage) * BENCH_TOKENS);
+  const char **argv = malloc(sizeof(*argv) * BENCH_TOKENS);
+  int *flags = malloc(sizeof(*flags) * 10000);
+  size_t c;
+  if (!names || !storage || !argv || !flags)
+    return 1;
+  printf("long option lookup:\n");
+  for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    int i, n = counts[c];
+    ap *parser = ap_init("bench");
+    clock_t start;
+    double ns;
+    if (!parser)
+      return 1;
+    for (i = 0; i < n; i++) {
+      sprintf(names[i], "option-%i", i);
+      if (ap_opt(parser, 0, names[i]))
+        return 1;
+      ap_type_flag(parser, flags + i);
+    }
+    bench_make_argv(argv, storage, BENCH_TOKENS, "--", names, n);
+    /* first parse builds the index, so leave it out of the measurement */
+    if (ap_parse(parser, BENCH_TOKENS, argv))
+      return 1;
+    start = clock();
+    if (ap_parse(parser, BENCH_TOKENS, argv))
+      return 1;
+    ns = bench_elapsed_ns(start);
+    printf("  %6i options: %8.2f ns/token\n", n, ns / BENCH_TOKENS);
+    ap_destroy(parser);
+  }
+  free(names), free(storage), free(argv), free(flags);
+  return 0;
+}
+
+/* per-token cost of parsing NUL-terminated argv versus pre-measured views,
+ * with long arguments so that measuring them matters */
+int bench_views(void) {
+  static char names[100][48];
+  static int values[100];
+  char(*storage)[64] = malloc(sizeof(*storage) * BENCH_TOKENS);
+  const char **argv = malloc(sizeof(*argv) * BENCH_TOKENS);
+  ap_view *views = malloc(sizeof(*views) * BENCH_TOKENS);
+  ap *parser = ap_init("bench");
+  int i;
+  clock_t start;
+  double ns_argv, ns_views;
+  if (!storage || !argv || !views || !parser)
+    return 1;
+  for (i = 0; i < 100; i++) {
+    sprintf(names[i], "a-rather-long-option-name-number-%i", i);
+    if (ap_opt(parser, 0, names[i]))
+      return 1;
+    ap_type_int(parser, values + i);
+  }
+  srand(1);
+  for (i = 0; i < BENCH_TOKENS; i += 2) {
+    sprintf(storage[i], "--%s", names[rand() % 100]);
+    sprintf(storage[i + 1], "%i", rand());
+  }
+  for (i = 0; i < BENCH_TOKENS; i++) {
+    argv[i] = storage[i];
+    views[i].ptr = storage[i];
+    views[i].len = strlen(storage[i]);
+  }
+  if (ap_parse(parser, BENCH_TOKENS, argv))
+    return 1;
+  start = clock();
+  if (ap_parse(parser, BENCH_TOKENS, argv))
+    return 1;
+  ns_argv = bench_elapsed_ns(start);
+  start = clock();
+  if (ap_parse_views(parser, BENCH_TOKENS, views))
+    return 1;
+  ns_views = bench_elapsed_ns(start);
+  printf("argument input (100 long options with int values):\n");
+  printf("  argv:  %8.2f ns/token\n", ns_argv / BENCH_TOKENS);
+  printf("  views: %8.2f ns/token\n", ns_views / BENCH_TOKENS);
+  ap_destroy(parser);
+  free(storage), free(argv), free(views);
+  return 0;
+}
+
+/* build a chain of `depth` nested subparsers, each selected by the command
+ * "x", with options "-c"/"--opt-c" for every printable c defined only at the
+ * root */
+ap *bench_make_nested(int depth, int *flags) {
+  static int out_idx;
+  static char names['z' + 1][8];
+  ap *root = ap_init("bench"), *par = root;
+  int d, c;
+  if (!root)
+    return NULL;
+  for (c = '0'; c <= 'z'; c++) {
+    sprintf(names[c], "opt-%c", c);
+    if (ap_opt(par, (char)c, names[c]))
+      return NULL;
+    ap_type_flag(par, flags + c);
+  }
+  for (d = 1; d < depth; d++) {
+    if (ap_pos(par, "cmd"))
+      return NULL;
+    ap_type_sub(par, "cmd", &out_idx);
+    if (ap_sub_add(par, "x", &par))
+      return NULL;
+  }
+  return root;
+}
+
+/* per-character cost of chained short options as parsers nest */
+int bench_short_opts(void) {
+  static char token[1025];
+  const char **argv = malloc(sizeof(*argv) * (BENCH_TOKENS / 16 + 8));
+  int flags[256], depth;
+  if (!argv)
+    return 1;
+  /* "-0123...": 1024 chained flag characters per token */
+  token[0] = '-';
+  for (depth = 1; depth < 1024; depth++)
+    token[depth] = (char)('0' + depth % ('z' - '0' + 1));
+  printf("chained short options:\n");
+  for (depth = 1; depth <= 5; depth++) {
+    ap *root = bench_make_nested(depth, flags);
+    int i, ntok = BENCH_TOKENS / 16, argc = 0;
+    clock_t start;
+    double ns;
+    if (!root)
+      return 1;
+    for (i = 1; i < depth; i++)
+      argv[argc++] = "x";
+    for (i = 0; i < ntok; i++)
+      argv[argc++] = token;
+    if (ap_parse(root, argc, argv))
+      return 1;
+    start = clock();
+    if (ap_parse(root, argc, argv))
+      return 1;
+    ns = bench_elapsed_ns(start);
+    printf(
+        "  depth %i: %6.2f ns/char\n", depth, ns / ((double)ntok * 1023));
+    ap_destroy(root);
+  }
+  free(argv);
+  return 0;
+}
+
+/* per-char cost of 80 chained switches as int flags versus bit flags */
+int bench_flag_bits(void) {
+  static char token[81];
+  static const char *argv[BENCH_TOKENS / 16];
+  int flags[80], mode, i, ntok = BENCH_TOKENS / 16;
+  unsigned long words[AP_FLAG_WORDS(80)];
+  token[0] = '-';
+  for (i = 1; i < 81; i++)
+    token[i] = (char)('0' + (i - 1) % 80);
+  for (i = 0; i < ntok; i++)
+    argv[i] = token;
+  printf("chained switches (80 per token):\n");
+  for (mode = 0; mode < 2; mode++) {
+    ap *parser = ap_init("bench");
+    clock_t start;
+    if (!parser)
+      return 1;
+    for (i = 0; i < 80; i++) {
+      if (ap_opt(parser, (char)('0' + i), NULL))
+        return 1;
+      if (mode)
+        ap_type_flag_bit(parser, words, i);
+      else
+        ap_type_flag(parser, flags + i);
+    }
+    if (ap_parse(parser, ntok, argv))
+      return 1;
+    start = clock();
+    if (ap_parse(parser, ntok, argv))
+      return 1;
+    printf(
+        "  %-16s %6.2f ns/char\n", mode ? "ap_type_flag_bit" : "ap_type_flag",
+        bench_elapsed_ns(start) / ((double)ntok * 80));
+    ap_destroy(parser);
+  }
+  return 0;
+}
+
+/* per-token cost of long options inherited from the root as parsers nest */
+int bench_nested_long_opts(void) {
+  const char **argv = malloc(sizeof(*argv) * (BENCH_TOKENS + 8));
+  int flags[256], depth;
+  if (!argv)
+    return 1;
+  printf("inherited long options:\n");
+  for (depth = 1; depth <= 5; depth++) {
+    ap *root = bench_make_nested(depth, flags);
+    int i, argc = 0;
+    clock_t start;
+    double ns;
+    if (!root)
+      return 1;
+    for (i = 1; i < depth; i++)
+      argv[argc++] = "x";
+    for (i = 0; i < BENCH_TOKENS; i++)
+      argv[argc++] = (i & 1) ? "--opt-a" : "--opt-Z";
+    if (ap_parse(root, argc, argv))
+      return 1;
+    start = clock();
+    if (ap_parse(root, argc, argv))
+      return 1;
+    ns = bench_elapsed_ns(start);
+    printf("  depth %i: %6.2f ns/token\n", depth, ns / BENCH_TOKENS);
+    ap_destroy(root);
+  }
+  free(argv);
+  return 0;
+}
+
+/* subcommand dispatch latency, against a walk of the subcommand list */
+int bench_subs(void) {
+  static const int counts[] = {10, 100, 1000};
+  char(*names)[16] = malloc(sizeof(*names) * 1000);
+  char(*storage)[24] = malloc(sizeof(*storage) * BENCH_TOKENS);
+  const char **argv = malloc(sizeof(*argv) * BENCH_TOKENS);
+  size_t c;
+  if (!names || !storage || !argv)
+    return 1;
+  printf("subcommand dispatch:\n");
+  for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    int i, n = counts[c], out_idx, found = 0;
+    ap *parser = ap_init("bench"), *sub;
+    clock_t start;
+    double ns, ns_walk;
+    if (!parser || ap_pos(parser, "command"))
+      return 1;
+    ap_type_sub(parser, "command", &out_idx);
+    for (i = 0; i < n; i++) {
+      sprintf(names[i], "command-%i", i);
+      if (ap_sub_add(parser, names[i], &sub))
+        return 1;
+    }
+    bench_make_argv(argv, storage, BENCH_TOKENS, "", names, n);
+    start = clock();
+    for (i = 0; i < BENCH_TOKENS; i++)
+      if (ap_parse(parser, 1, argv + i))
+        return 1;
+    ns = bench_elapsed_ns(start);
+    /* reference: newest-first strcmp walk, as a linked list of subcommands
+     * would be searched */
+    start = clock();
+    for (i = 0; i < BENCH_TOKENS; i++) {
+      int j = n;
+      while (j-- && strcmp(names[j], argv[i]))
+        ;
+      found += j < 0;
+    }
+    ns_walk = bench_elapsed_ns(start);
+    if (found)
+      return 1;
+    printf(
+        "  %5i subcommands: %8.2f ns/dispatch (list walk: %8.2f ns)\n", n,
+        ns / BENCH_TOKENS, ns_walk / BENCH_TOKENS);
+    ap_destroy(parser);
+  }
+  free(names), free(storage), free(argv);
+  return 0;
+}
+
+/* enum matching cost as the number of choices grows, against a linear scan */
+int bench_enum(void) {
+  static const int counts[] = {10, 100, 1000, 5000};
+  char(*names)[16] = malloc(sizeof(*names) * 5000);
+  const char **choices = malloc(sizeof(*choices) * 5001);
+  char(*storage)[24] = malloc(sizeof(*storage) * BENCH_TOKENS);
+  const char **argv = malloc(sizeof(*argv) * BENCH_TOKENS * 2);
+  size_t c;
+  if (!names || !choices || !storage || !argv)
+    return 1;
+  printf("enum matching:\n");
+  for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    int i, n = counts[c], out, missing = 0;
+    ap *parser = ap_init("bench");
+    clock_t start;
+    double ns, ns_scan;
+    if (!parser)
+      return 1;
+    for (i = 0; i < n; i++) {
+      sprintf(names[i], "zone-%i", i);
+      choices[i] = names[i];
+    }
+    choices[n] = NULL;
+    if (ap_opt(parser, 'e', NULL) || ap_type_enum(parser, &out, choices))
+      return 1;
+    bench_make_argv(argv + BENCH_TOKENS, storage, BENCH_TOKENS, "", names, n);
+    for (i = 0; i < BENCH_TOKENS; i++)
+      argv[i * 2] = "-e", argv[i * 2 + 1] = argv[BENCH_TOKENS + i];
+    start = clock();
+    if (ap_parse(parser, BENCH_TOKENS * 2, argv))
+      return 1;
+    ns = bench_elapsed_ns(start);
+    bench_make_argv(argv, storage, BENCH_TOKENS, "", names, n);
+    /* reference: strcmp against each choice in turn */
+    start = clock();
+    for (i = 0; i < BENCH_TOKENS; i++) {
+      const char **cur = choices;
+      while (*cur && strcmp(*cur, argv[i]))
+        cur++;
+      missing += !*cur;
+    }
+    ns_scan = bench_elapsed_ns(start);
+    if (missing)
+      return 1;
+    printf(
+        "  %5i choices: %8.2f ns/value (linear scan: %8.2f ns)\n", n,
+        ns / BENCH_TOKENS, ns_scan / BENCH_TOKENS);
+    ap_destroy(parser);
+  }
+  free(names), free(choices), free(storage), free(argv);
+  return 0;
+}
+
+/* allocator that counts calls, for comparing allocation modes */
+void *bench_counting_alloc(void *uptr, void *ptr, size_t old, size_t n) {
+  (void)old;
+  if (!n) {
+    free(ptr);
+    return NULL;
+  }
+  ++*(long *)uptr;
+  return realloc(ptr, n);
+}
+
+/* build a 500-option, 100-subcommand CLI */
+int bench_build_cli(ap *parser, int *flags, char (*names)[16]) {
+  static int out_idx;
+  ap *sub;
+  int i;
+  for (i = 0; i < 500; i++) {
+    sprintf(names[i], "option-%i", i);
+    if (ap_opt(parser, 0, names[i]))
+      return 1;
+    ap_type_flag(parser, flags + i);
+  }
+  if (ap_pos(parser, "command"))
+    return 1;
+  ap_type_sub(parser, "command", &out_idx);
+  for (i = 0; i < 100; i++)
+    if (ap_sub_add(parser, names[i], &sub) || ap_opt(sub, 'x', NULL))
+      return 1;
+    else
+      ap_type_flag(sub, flags + i);
+  return ap_compile(parser);
+}
+
+/* allocator calls and time to build and destroy a large CLI */
+int bench_arena(void) {
+  static int flags[500];
+  static char names[500][16];
+  int mode, i, reps = 200;
+  printf("parser construction (500 options, 100 subcommands):\n");
+  for (mode = 0; mode < 2; mode++) {
+    ap_ctxcb cb = {0};
+    long calls = 0;
+    clock_t start = clock();
+    cb.uptr = &calls;
+    cb.alloc = bench_counting_alloc;
+    for (i = 0; i < reps; i++) {
+      ap *parser;
+      if ((mode ? ap_init_arena : ap_init_full)(&parser, "bench", &cb) ||
+          bench_build_cli(parser, flags, names))
+        return 1;
+      ap_destroy(parser);
+    }
+    printf(
+        "  %s: %5li allocations, %8.2f us/build\n", mode ? "arena" : "heap ",
+        calls / reps, bench_elapsed_ns(start) / reps / 1000);
+  }
+  return 0;
+}
+
+/* add 20 flag options to a subcommand */
+int bench_sub_builder(void *uptr, ap *sub) {
+  static int flags[20];
+  char(*names)[16] = uptr;
+  int i, err;
+  for (i = 0; i < 20; i++)
+    if ((err = ap_opt(sub, 0, names[i])))
+      return err;
+    else
+      ap_type_flag(sub, flags + i);
+  return AP_ERR_NONE;
+}
+
+/* startup cost of a 400-subcommand CLI, building every subparser up front
+ * versus only the selected one */
+int bench_lazy(void) {
+  static char names[400][16];
+  const char *argv[2];
+  int mode, i, reps = 200;
+  for (i = 0; i < 400; i++)
+    sprintf(names[i], "cmd-%i", i);
+  argv[0] = names[123];
+  argv[1] = "--cmd-7";
+  printf("build + parse one command (400 subcommands, 20 options each):\n");
+  for (mode = 0; mode < 2; mode++) {
+    ap_ctxcb cb = {0};
+    long calls = 0;
+    clock_t start = clock();
+    int r;
+    cb.uptr = &calls;
+    cb.alloc = bench_counting_alloc;
+    for (r = 0; r < reps; r++) {
+      ap *parser, *sub;
+      if (ap_init_full(&parser, "bench", &cb) || ap_pos(parser, "command"))
+        return 1;
+      ap_type_sub(parser, "command", NULL);
+      for (i = 0; i < 400; i++)
+        if (mode ? ap_sub_add_lazy(parser, names[i], bench_sub_builder, names)
+                 : ap_sub_add(parser, names[i], &sub) ||
+                       bench_sub_builder(names, sub))
+          return 1;
+      if (ap_parse(parser, 2, argv))
+        return 1;
+      ap_destroy(parser);
+    }
+    printf(
+        "  %s: %6li allocations, %8.2f us/run\n", mode ? "lazy " : "eager",
+        calls / reps, bench_elapsed_ns(start) / reps / 1000);
+  }
+  return 0;
+}
+
+int bench_sscanf_cb(void *uptr, ap_cb_data *pdata) {
+  if (sscanf(pdata->arg, "%i", (int *)uptr) != 1)
+    return ap_arg_error(pdata, "invalid integer argument");
+  return pdata->arg_len;
+}
+
+int bench_strtol_cb(void *uptr, ap_cb_data *pdata) {
+  char *end;
+  *(int *)uptr = (int)strtol(pdata->arg, &end, 0);
+  if (end != pdata->arg + pdata->arg_len)
+    return ap_arg_error(pdata, "invalid integer argument");
+  return pdata->arg_len;
+}
+
+/* per-value cost of integer arguments, parsed by the built-in type versus
+ * custom callbacks around sscanf and strtol */
+int bench_ints(void) {
+  static const char *const names[] = {"ap_type_int", "sscanf", "strtol"};
+  int nvals = 1000000, i, mode, out;
+  char(*storage)[16] = malloc(sizeof(*storage) * (size_t)nvals);
+  const char **argv = malloc(sizeof(*argv) * (size_t)nvals * 2);
+  if (!storage || !argv)
+    return 1;
+  srand(1);
+  for (i = 0; i < nvals; i++) {
+    if (i % 4)
+      sprintf(storage[i], "%i", rand() - RAND_MAX / 2);
+    else
+      sprintf(storage[i], "0x%x", (unsigned)rand());
+    argv[i * 2] = "-n";
+    argv[i * 2 + 1] = storage[i];
+  }
+  printf("integer parsing (%i values):\n", nvals);
+  for (mode = 0; mode < 3; mode++) {
+    ap *parser = ap_init("bench");
+    clock_t start;
+    if (!parser || ap_opt(parser, 'n', NULL))
+      return 1;
+    if (mode == 0)
+      ap_type_int(parser, &out);
+    else
+      ap_type_custom(parser, mode == 1 ? bench_sscanf_cb : bench_strtol_cb,
+                     &out);
+    start = clock();
+    if (ap_parse(parser, nvals * 2, argv))
+      return 1;
+    printf(
+        "  %-12s %8.2f ns/value\n", names[mode],
+        bench_elapsed_ns(start) / nvals);
+    ap_destroy(parser);
+  }
+  free(storage), free(argv);
+  return 0;
+}
+
+int bench_strtod_cb(void *uptr, ap_cb_data *pdata) {
+  char *end;
+  *(double *)uptr = strtod(pdata->arg, &end);
+  if (end != pdata->arg + pdata->arg_len)
+    return ap_arg_error(pdata, "invalid number argument");
+  return pdata->arg_len;
+}
+
+/* per-value cost of double arguments, parsed by the built-in type versus a
+ * custom callback around strtod */
+int bench_doubles(void) {
+  int nvals = 1000000, i, mode;
+  double out;
+  char(*storage)[32] = malloc(sizeof(*storage) * (size_t)nvals);
+  const char **argv = malloc(sizeof(*argv) * (size_t)nvals * 2);
+  if (!storage || !argv)
+    return 1;
+  srand(1);
+  for (i = 0; i < nvals; i++) {
+    double v = (double)rand() / RAND_MAX * 1000;
+    /* mostly short parameters, some with full precision */
+    sprintf(storage[i], i % 8 ? "%.3f" : "%.17g", i % 3 ? v : -v / 1e9);
+    argv[i * 2] = "-x";
+    argv[i * 2 + 1] = storage[i];
+  }
+  printf("double parsing (%i values):\n", nvals);
+  for (mode = 0; mode < 2; mode++) {
+    ap *parser = ap_init("bench");
+    clock_t start;
+    if (!parser || ap_opt(parser, 'x', NULL))
+      return 1;
+    if (mode == 0)
+      ap_type_double(parser, &out);
+    else
+      ap_type_custom(parser, bench_strtod_cb, &out);
+    start = clock();
+    if (ap_parse(parser, nvals * 2, argv))
+      return 1;
+    printf(
+        "  %-14s %8.2f ns/value\n", mode ? "strtod" : "ap_type_double",
+        bench_elapsed_ns(start) / nvals);
+    ap_destroy(parser);
+  }
+  free(storage), free(argv);
+  return 0;
+}
+
+/* per-element cost and allocator calls of appending to a list argument */
+int bench_lists(void) {
+  int nvals = 1000000, i, mode;
+  const char **argv = malloc(sizeof(*argv) * (size_t)nvals * 2);
+  if (!argv)
+    return 1;
+  for (i = 0; i < nvals; i++)
+    argv[i * 2] = "-I", argv[i * 2 + 1] = "dir";
+  printf("list appends (%i elements):\n", nvals);
+  for (mode = 0; mode < 2; mode++) {
+    ap_ctxcb cb = {0};
+    long calls = 0;
+    ap *parser;
+    ap_str_list dirs;
+    clock_t start;
+    cb.uptr = &calls;
+    cb.alloc = bench_counting_alloc;
+    if ((mode ? ap_init_arena : ap_init_full)(&parser, "bench", &cb) ||
+        ap_opt(parser, 'I', NULL))
+      return 1;
+    ap_type_str_list(parser, &dirs);
+    calls = 0;
+    start = clock();
+    if (ap_parse(parser, nvals * 2, argv) || dirs.len != (size_t)nvals)
+      return 1;
+    printf(
+        "  %s: %3li allocations, %8.2f ns/element\n", mode ? "arena" : "heap ",
+        calls, bench_elapsed_ns(start) / nvals);
+    ap_destroy(parser);
+  }
+  free(argv);
+  return 0;
+}
+
+/* the usual custom callback for delimited IDs: strtol in a loop */
+int bench_split_strtol_cb(void *uptr, ap_cb_data *pdata) {
+  ap_int_list *out = uptr;
+  const char *p = pdata->arg;
+  char *end;
+  out->len = 0;
+  while (1) {
+    out->items[out->len++] = (int)strtol(p, &end, 10);
+    if (*end != ',')
+      break;
+    p = end + 1;
+  }
+  if (end != pdata->arg + pdata->arg_len)
+    return ap_arg_error(pdata, "invalid integer list");
+  return pdata->arg_len;
+}
+
+/* throughput of one token holding 200k comma-separated IDs */
+int bench_split(void) {
+  int nvals = 200000, reps = 20, i, mode;
+  char *token = malloc((size_t)nvals * 12), *p = token;
+  int *storage = malloc(sizeof(*storage) * (size_t)nvals);
+  const char *argv[2];
+  if (!token || !storage)
+    return 1;
+  srand(1);
+  for (i = 0; i < nvals; i++)
+    p += sprintf(p, i ? ",%i" : "%i", rand() % (i % 2 ? 100000 : 1000000000));
+  argv[0] = "--ids", argv[1] = token;
+  printf(
+      "delimited integers (%i values, %i bytes):\n", nvals, (int)(p - token));
+  for (mode = 0; mode < 2; mode++) {
+    ap *parser = ap_init("bench");
+    ap_int_list ids = {0};
+    clock_t start;
+    double ns;
+    if (!parser || ap_opt(parser, 0, "ids"))
+      return 1;
+    ids.items = storage, ids.cap = (size_t)nvals;
+    if (mode == 0)
+      ap_type_int_split(parser, &ids, ',');
+    else
+      ap_type_custom(parser, bench_split_strtol_cb, &ids);
+    start = clock();
+    for (i = 0; i < reps; i++) {
+      ids.len = 0;
+      if (ap_parse(parser, 2, argv) || ids.len != (size_t)nvals)
+        return 1;
+    }
+    ns = bench_elapsed_ns(start) / reps;
+    printf(
+        "  %-17s %6.2f ns/value, %5.2f GB/s\n",
+        mode ? "strtol" : "ap_type_int_split", ns / nvals,
+        (double)(p - token) / ns);
+    ap_destroy(parser);
+  }
+  free(token), free(storage);
+  return 0;
+}
+
+/* results of one command line, written through the session's base pointer */
+struct bench_cmd {
+  int threads;
+  const char *name;
+};
+
+int bench_cmd_threads_cb(void *uptr, ap_cb_data *pdata) {
+  (void)uptr;
+  if (!pdata->arg)
+    return ap_arg_error(pdata, "expected a number");
+  ((struct bench_cmd *)pdata->base)->threads = atoi(pdata->arg);
+  return pdata->arg_len;
+}
+
+int bench_cmd_name_cb(void *uptr, ap_cb_data *pdata) {
+  (void)uptr;
+  ((struct bench_cmd *)pdata->base)->name = pdata->arg;
+  return pdata->arg_len;
+}
+
+/* per-command cost and allocations of parsing in a session, repeatedly, on
+ * one compiled parser */
+int bench_session(void) {
+  static const char *const argv[] = {"--threads=8", "-v", "--retry", "job"};
+  static const char *const bad[] = {"--threads"};
+  static int flags[32];
+  static char names[32][16];
+  int i, n = 1000000;
+  ap_ctxcb cb = {0};
+  long calls = 0;
+  ap *parser;
+  ap_session *sess;
+  struct bench_cmd cmd;
+  clock_t start;
+  cb.uptr = &calls;
+  cb.alloc = bench_counting_alloc;
+  if (ap_init_full(&parser, "bench", &cb))
+    return 1;
+  for (i = 0; i < 32; i++) {
+    sprintf(names[i], "opt-%i", i);
+    if (ap_opt(parser, 0, names[i]))
+      return 1;
+    ap_type_flag(parser, flags + i);
+  }
+  if (ap_opt(parser, 'v', NULL))
+    return 1;
+  ap_type_flag(parser, flags);
+  if (ap_opt(parser, 0, "retry"))
+    return 1;
+  ap_type_flag(parser, flags + 1);
+  if (ap_opt(parser, 't', "threads"))
+    return 1;
+  ap_type_custom(parser, bench_cmd_threads_cb, NULL);
+  if (ap_pos(parser, "name"))
+    return 1;
+  ap_type_custom(parser, bench_cmd_name_cb, NULL);
+  if (ap_compile(parser) || ap_session_begin(&sess, parser))
+    return 1;
+  printf("parse sessions (%i commands):\n", n);
+  calls = 0;
+  start = clock();
+  for (i = 0; i < n; i++) {
+    ap_session_reset(sess, &cmd);
+    if (ap_session_parse(sess, 4, argv) || cmd.threads != 8)
+      return 1;
+  }
+  printf(
+      "  valid:    %li allocations, %8.2f ns/command\n", calls,
+      bench_elapsed_ns(start) / n);
+  start = clock();
+  for (i = 0; i < n; i++) {
+    ap_session_reset(sess, &cmd);
+    if (ap_session_parse(sess, 1, bad) != AP_ERR_PARSE)
+      return 1;
+  }
+  printf(
+      "  rejected: %li allocations, %8.2f ns/command\n", calls,
+      bench_elapsed_ns(start) / n);
+  ap_session_end(sess);
+  ap_destroy(parser);
+  return 0;
+}
+
+/* count calls to the print callback, discarding the text */
+int bench_counting_print(void *uptr, int fd, const char *text, size_t n) {
+  (void)fd, (void)text, (void)n;
+  ++*(long *)uptr;
+  return 0;
+}
+
+/* runs batch jobs one after another on this thread */
+void bench_serial_runner(void *uptr, int njobs, ap_batch_job job, void *arg) {
+  int i;
+  (void)uptr;
+  for (i = 0; i < njobs; i++)
+    job(arg, i);
+}
+
+/* per-record cost of replaying a million recorded command lines, 1% of them
+ * invalid, one parse at a time versus as a batch */
+int bench_batch(void) {
+  static const char *const valid[] = {"--threads=8", "-v", "job"};
+  static const char *const invalid[] = {"--threads", "x"};
+  int n = 1000000, i, mode, flags[2];
+  ap_cmdline *cmds = malloc(sizeof(*cmds) * (size_t)n);
+  struct bench_cmd *results = malloc(sizeof(*results) * (size_t)n);
+  int *status = malloc(sizeof(*status) * (size_t)n);
+  ap_ctxcb cb = {0};
+  long prints = 0;
+  ap *parser;
+  if (!cmds || !results || !status)
+    return 1;
+  cb.uptr = &prints;
+  cb.print = bench_counting_print;
+  if (ap_init_full(&parser, "bench", &cb) || ap_opt(parser, 'v', NULL))
+    return 1;
+  ap_type_flag(parser, flags);
+  if (ap_opt(parser, 0, "retry"))
+    return 1;
+  ap_type_flag(parser, flags + 1);
+  if (ap_opt(parser, 't', "threads"))
+    return 1;
+  ap_type_custom(parser, bench_cmd_threads_cb, NULL);
+  if (ap_pos(parser, "name"))
+    return 1;
+  ap_type_custom(parser, bench_cmd_name_cb, NULL);
+  if (ap_compile(parser))
+    return 1;
+  for (i = 0; i < n; i++) {
+    cmds[i].argc = i % 100 ? 3 : 2;
+    cmds[i].argv = i % 100 ? valid : invalid;
+  }
+  printf("batch parsing (%i command lines):\n", n);
+  for (mode = 0; mode < 3; mode++) {
+    static const char *const names[] = {"ap_parse_into", "batch, 1 worker",
+                                        "batch, 8 workers"};
+    ap_batch batch = {0};
+    clock_t start = clock();
+    int failed = 0;
+    batch.cmds = cmds, batch.n = n;
+    batch.results = results, batch.result_size = sizeof(*results);
+    batch.status = status;
+    batch.nworkers = mode == 2 ? 8 : 1;
+    batch.runner = mode == 2 ? bench_serial_runner : NULL;
+    if (mode == 0) {
+      for (i = 0; i < n; i++)
+        failed += !!ap_parse_into(
+            parser, results + i, cmds[i].argc, cmds[i].argv);
+    } else {
+      failed = ap_parse_batch(parser, &batch);
+    }
+    if (failed != n / 100)
+      return 1;
+    printf(
+        "  %-17s %8.2f ns/record\n", names[mode],
+        bench_elapsed_ns(start) / n);
+  }
+  ap_destroy(parser);
+  free(cmds), free(results), free(status);
+  return 0;
+}
+
+/* print calls and time to render help for a 1000-option parser */
+int bench_help(void) {
+  static char names[1000][16];
+  static int flags[1000];
+  ap_ctxcb cb = {0};
+  long calls = 0;
+  ap *parser;
+  int i, reps = 100;
+  clock_t start;
+  cb.uptr = &calls;
+  cb.print = bench_counting_print;
+  if (ap_init_full(&parser, "bench", &cb))
+    return 1;
+  for (i = 0; i < 1000; i++) {
+    sprintf(names[i], "option-%i", i);
+    if (ap_opt(parser, 0, names[i]))
+      return 1;
+    ap_type_flag(parser, flags + i);
+    ap_help(parser, "an option that does something");
+  }
+  printf("help rendering (1000 options):\n");
+  start = clock();
+  if (ap_show_help(parser))
+    return 1;
+  printf(
+      "  first:  %li print calls, %8.2f us/render\n", calls,
+      bench_elapsed_ns(start) / 1000);
+  calls = 0;
+  start = clock();
+  for (i = 0; i < reps; i++)
+    if (ap_show_help(parser))
+      return 1;
+  printf(
+      "  repeat: %li print calls, %8.2f us/render\n", calls / reps,
+      bench_elapsed_ns(start) / reps / 1000);
+  /* aligned and wrapped layout, rendered from scratch each time */
+  start = clock();
+  for (i = 0; i < reps; i++) {
+    ap_help_width(parser, 100);
+    if (ap_show_help(parser))
+      return 1;
+  }
+  printf(
+      "  aligned, 100 columns: %8.2f us/render\n",
+      bench_elapsed_ns(start) / reps / 1000);
+  ap_destroy(parser);
+  return 0;
+}
+
+/* per-token cost of matching and dispatching long options through the
+ * option records of a compiled parser, as the tables outgrow the caches; run
+ * under `perf stat -e cache-misses ./bench layout` to count the misses */
+int bench_layout(void) {
+  static const int counts[] = {1000, 30000, 300000};
+  int nmax = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+  char(*names)[16] = malloc(sizeof(*names) * (size_t)nmax);
+  char(*storage)[24] = malloc(sizeof(*storage) * BENCH_TOKENS);
+  const char **argv = malloc(sizeof(*argv) * BENCH_TOKENS);
+  int *flags = malloc(sizeof(*flags) * (size_t)nmax);
+  size_t c;
+  if (!names || !storage || !argv || !flags)
+    return 1;
+  printf("option records (compiled parser, random long options):\n");
+  for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+    int i, n = counts[c];
+    unsigned long seed;
+    ap *parser = NULL;
+    clock_t start;
+    double ns;
+    if (ap_init_arena(&parser, "bench", NULL))
+      return 1;
+    for (i = 0; i < n; i++) {
+      sprintf(names[i], "opt-%i", i);
+      if (ap_opt(parser, 0, names[i]))
+        return 1;
+      ap_type_flag(parser, flags + i);
+    }
+    if (ap_compile(parser))
+      return 1;
+    /* draw the options with an LCG, since RAND_MAX may be less than `n` */
+    for (i = 0, seed = 1; i < BENCH_TOKENS; i++) {
+      seed = (seed * 1103515245 + 12345) & 0xffffffff;
+      sprintf(storage[i], "--%s", names[(seed >> 8) % (unsigned long)n]);
+      argv[i] = storage[i];
+    }
+    if (ap_parse(parser, BENCH_TOKENS, argv))
+      return 1;
+    start = clock();
+    for (i = 0; i < 10; i++)
+      if (ap_parse(parser, BENCH_TOKENS, argv))
+        return 1;
+    ns = bench_elapsed_ns(start) / 10;
+    printf("  %7i options: %8.2f ns/token\n", n, ns / BENCH_TOKENS);
+    ap_destroy(parser);
+  }
+  free(names), free(storage), free(argv), free(flags);
+  return 0;
+}
+
+int main(int argc, const char *const *argv) {
+  /* optionally pass a benchmark name to run just that benchmark */
+  const char *only = argc > 1 ? argv[1] : NULL;
+  if ((!only || !strcmp(only, "long_opts")) && bench_long_opts())
+    return 1;
+  if ((!only || !strcmp(only, "views")) && bench_views())
+    return 1;
+  if ((!only || !strcmp(only, "short_opts")) && bench_short_opts())
+    return 1;
+  if ((!only || !strcmp(only, "flag_bits")) && bench_flag_bits())
+    return 1;
+  if ((!only || !strcmp(only, "nested_long_opts")) && bench_nested_long_opts())
+    return 1;
+  if ((!only || !strcmp(only, "subs")) && bench_subs())
+    return 1;
+  if ((!only || !strcmp(only, "enum")) && bench_enum())
+    return 1;
+  if ((!only || !strcmp(only, "arena")) && bench_arena())
+    return 1;
+  if ((!only || !strcmp(only, "lazy")) && bench_lazy())
+    return 1;
+  if ((!only || !strcmp(only, "ints")) && bench_ints())
+    return 1;
+  if ((!only || !strcmp(only, "doubles")) && bench_doubles())
+    return 1;
+  if ((!only || !strcmp(only, "lists")) && bench_lists())
+    return 1;
+  if ((!only || !strcmp(only, "split")) && bench_split())
+    return 1;
+  if ((!only || !strcmp(only, "session")) && bench_session())
+    return 1;
+  if ((!only || !strcmp(only, "batch")) && bench_batch())
+    return 1;
+  if ((!only || !strcmp(only, "help")) && bench_help())
+    return 1;
+  if ((!only || !strcmp(only, "layout")) && bench_layout())
+    return 1;
+  return 0;
+}
@@ -1,4 +1,8 @@
 #include <aparse.h>
+#include <float.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define MPTEST_IMPLEMENTATION
@@ -124,6 +128,71 @@ done:
   PASS();
 }
 
+TEST(opt_short_attached_value) {
+  ap *parser = ap_init("test");
+  int flag = 0, num = 0;
+  const char *const argv[] = {"-vn42"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'v', NULL))
+    goto done;
+  ap_type_flag(parser, &flag);
+  if (ap_opt(parser, 'n', NULL))
+    goto done;
+  ap_type_int(parser, &num);
+  ASSERT(!ap_parse(parser, 1, argv));
+  ASSERT_EQ(flag, 1);
+  ASSERT_EQ(num, 42);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(opt_long_many) {
+  ap *parser = ap_init("test");
+  int flags[64] = {0};
+  char names[64][8];
+  int i;
+  const char *const argv[] = {"--o7", "--o63", "--o0"};
+  if (!parser)
+    goto done;
+  for (i = 0; i < 64; i++) {
+    sprintf(names[i], "o%i", i);
+    if (ap_opt(parser, 0, names[i]))
+      goto done;
+    ap_type_flag(parser, flags + i);
+  }
+  ASSERT(!ap_parse(parser, 3, argv));
+  ASSERT_EQ(flags[0], 1);
+  ASSERT_EQ(flags[7], 1);
+  ASSERT_EQ(flags[63], 1);
+  ASSERT_EQ(flags[1], 0);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(opt_long_added_after_parse) {
+  ap *parser = ap_init("test");
+  int first = 0, second = 0;
+  const char *const argv[] = {"--second"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 0, "first"))
+    goto done;
+  ap_type_flag(parser, &first);
+  ASSERT_EQ(ap_parse(parser, 1, argv), AP_ERR_PARSE);
+  if (ap_opt(parser, 0, "second"))
+    goto done;
+  ap_type_flag(parser, &second);
+  ASSERT(!ap_parse(parser, 1, argv));
+  ASSERT_EQ(second, 1);
+  ASSERT_EQ(first, 0);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
 TEST(pos_specified) {
   ap *parser = ap_init("test");
   int err = 0;
@@ -144,6 +213,43 @@ done:
   PASS();
 }
 
+TEST(parse_views) {
+  ap *parser = ap_init("test");
+  int flag = 0, num = 0, count = 0;
+  ap_view name = {NULL, 0};
+  /* slices of one buffer, none of them NUL-terminated */
+  static const char buf[] = {'-', 'v', 'n', '4', '2', '-', '-', 'c', 'o', 'u',
+                             'n', 't', '7', 'n', 'a', 'm', 'e', '9'};
+  ap_view argv[4];
+  argv[0].ptr = buf, argv[0].len = 5;
+  argv[1].ptr = buf + 5, argv[1].len = 7;
+  argv[2].ptr = buf + 12, argv[2].len = 1;
+  argv[3].ptr = buf + 13, argv[3].len = 4;
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'v', NULL))
+    goto done;
+  ap_type_flag(parser, &flag);
+  if (ap_opt(parser, 'n', NULL))
+    goto done;
+  ap_type_int(parser, &num);
+  if (ap_opt(parser, 0, "count"))
+    goto done;
+  ap_type_int(parser, &count);
+  if (ap_pos(parser, "name"))
+    goto done;
+  ap_type_view(parser, &name);
+  ASSERT(!ap_parse_views(parser, 4, argv));
+  ASSERT_EQ(flag, 1);
+  ASSERT_EQ(num, 42);
+  ASSERT_EQ(count, 7);
+  ASSERT_EQ(name.ptr, buf + 13);
+  ASSERT_EQ(name.len, 4);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
 TEST(sub_empty) {
   ap *parser = ap_init("test");
   int err = 0;
@@ -173,13 +279,271 @@ done:
   PASS();
 }
 
+TEST(sub_inherits_parent_opts) {
+  ap *parser = ap_init("test");
+  int verbose = 0, sub_flag = 0, shadow = 0, late = 0, out_idx = 0;
+  const char *const argv[] = {"run", "-vxv", "-q"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'v', NULL))
+    goto done;
+  ap_type_flag(parser, &verbose);
+  if (ap_opt(parser, 'x', NULL))
+    goto done;
+  ap_type_flag(parser, &shadow);
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub(parser, "command", &out_idx);
+  {
+    ap *sub;
+    if (ap_sub_add(parser, "run", &sub))
+      goto done;
+    if (ap_opt(sub, 'x', NULL))
+      goto done;
+    ap_type_flag(sub, &sub_flag);
+  }
+  /* parent options added after the subparser must still be visible */
+  if (ap_opt(parser, 'q', NULL))
+    goto done;
+  ap_type_flag(parser, &late);
+  ASSERT(!ap_parse(parser, 3, argv));
+  ASSERT_EQ(verbose, 1);
+  ASSERT_EQ(sub_flag, 1);
+  ASSERT_EQ(shadow, 0);
+  ASSERT_EQ(late, 1);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(sub_nested_long_shadowing) {
+  ap *parser = ap_init("test");
+  int root_verbose = 0, root_mode = 0, mid_mode = 0, out_idx = 0;
+  const char *const argv[] = {"cluster", "node", "--verbose", "--mode"};
+  ap *mid, *leaf;
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 0, "verbose"))
+    goto done;
+  ap_type_flag(parser, &root_verbose);
+  if (ap_opt(parser, 0, "mode"))
+    goto done;
+  ap_type_flag(parser, &root_mode);
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub(parser, "command", &out_idx);
+  if (ap_sub_add(parser, "cluster", &mid))
+    goto done;
+  if (ap_opt(mid, 0, "mode"))
+    goto done;
+  ap_type_flag(mid, &mid_mode);
+  if (ap_pos(mid, "command"))
+    goto done;
+  ap_type_sub(mid, "command", &out_idx);
+  if (ap_sub_add(mid, "node", &leaf))
+    goto done;
+  ASSERT(!ap_parse(parser, 4, argv));
+  ASSERT_EQ(root_verbose, 1);
+  ASSERT_EQ(mid_mode, 1);
+  ASSERT_EQ(root_mode, 0);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(sub_many) {
+  ap *parser = ap_init("test");
+  int out_idx = -1, i, arg = 0;
+  char names[100][8];
+  const char *const argv[] = {"c42", "7"};
+  const char *const argv_bad[] = {"c100"};
+  if (!parser)
+    goto done;
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub(parser, "command", &out_idx);
+  for (i = 0; i < 100; i++) {
+    ap *sub;
+    sprintf(names[i], "c%i", i);
+    if (ap_sub_add(parser, names[i], &sub))
+      goto done;
+    if (i == 42) {
+      if (ap_pos(sub, "arg"))
+        goto done;
+      ap_type_int(sub, &arg);
+    }
+  }
+  ASSERT(!ap_parse(parser, 2, argv));
+  ASSERT_EQ(out_idx, 42);
+  ASSERT_EQ(arg, 7);
+  ASSERT_EQ(ap_parse(parser, 1, argv_bad), AP_ERR_PARSE);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+struct lazy {
+  int builds; /* number of times the builder ran */
+  int arg;
+};
+
+static int lazy_builder(void *uptr, ap *sub) {
+  struct lazy *l = (struct lazy *)uptr;
+  int err;
+  l->builds++;
+  if ((err = ap_pos(sub, "arg")))
+    return err;
+  ap_type_int(sub, &l->arg);
+  return AP_ERR_NONE;
+}
+
+TEST(sub_lazy) {
+  ap *parser = ap_init("test");
+  int out_idx = -1;
+  struct lazy a = {0}, b = {0};
+  const char *const argv[] = {"b", "7"};
+  if (!parser)
+    goto done;
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub(parser, "command", &out_idx);
+  if (ap_sub_add_lazy(parser, "a", lazy_builder, &a) ||
+      ap_sub_add_lazy(parser, "b", lazy_builder, &b))
+    goto done;
+  ASSERT_EQ(b.builds, 0);
+  ASSERT(!ap_parse(parser, 2, argv));
+  ASSERT_EQ(out_idx, 1);
+  ASSERT_EQ(b.arg, 7);
+  ASSERT_EQ(a.builds, 0);
+  ASSERT_EQ(b.builds, 1);
+  ASSERT(!ap_parse(parser, 2, argv));
+  ASSERT_EQ(b.builds, 1);
+  /* compiling builds the rest of the tree */
+  ASSERT(!ap_compile(parser));
+  ASSERT_EQ(a.builds, 1);
+  ASSERT_EQ(b.builds, 1);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(compile) {
+  ap *parser = ap_init("test");
+  int verbose = 0, force = 0, out_idx = -1;
+  const char *file = NULL;
+  const char *const argv[] = {"rm", "-vf", "--verbose", "a.txt"};
+  ap *rm, *ls;
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'v', "verbose"))
+    goto done;
+  ap_type_flag(parser, &verbose);
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub(parser, "command", &out_idx);
+  if (ap_sub_add(parser, "ls", &ls) || ap_sub_add(parser, "rm", &rm))
+    goto done;
+  if (ap_opt(rm, 'f', "force"))
+    goto done;
+  ap_type_flag(rm, &force);
+  if (ap_pos(rm, "file"))
+    goto done;
+  ap_type_str(rm, &file);
+  /* build lazy tables first, so that compiling must replace them */
+  ASSERT(!ap_parse(parser, 4, argv));
+  ASSERT(!ap_compile(parser));
+  ASSERT(!ap_compile(parser));
+  verbose = force = 0, file = NULL;
+  ASSERT(!ap_parse(parser, 4, argv));
+  ASSERT_EQ(verbose, 1);
+  ASSERT_EQ(force, 1);
+  ASSERT_EQ(out_idx, 1);
+  ASSERT(file && !strcmp(file, "a.txt"));
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+struct allocs {
+  int calls;  /* number of allocations made */
+  int live;   /* number of allocations not yet freed */
+  size_t max; /* size of the largest allocation */
+};
+
+void *counting_alloc_cb(void *uptr, void *ptr, size_t old, size_t n) {
+  struct allocs *a = (struct allocs *)uptr;
+  (void)old;
+  if (!n) {
+    a->live--;
+    free(ptr);
+    return NULL;
+  }
+  a->calls++;
+  a->max = n > a->max ? n : a->max;
+  if (!ptr)
+    a->live++;
+  return realloc(ptr, n);
+}
+
+/* build a CLI with 500 options spread over the root and 100 subcommands */
+int build_big_cli(ap *parser, int *flags, char (*names)[16]) {
+  static int out_idx;
+  int i;
+  ap *sub = NULL;
+  for (i = 0; i < 400; i++) {
+    sprintf(names[i], "option-%i", i);
+    if (ap_opt(parser, 0, names[i]))
+      return AP_ERR_NOMEM;
+    ap_type_flag(parser, flags + i);
+  }
+  if (ap_pos(parser, "command"))
+    return AP_ERR_NOMEM;
+  ap_type_sub(parser, "command", &out_idx);
+  for (i = 0; i < 100; i++) {
+    sprintf(names[400 + i], "command-%i", i);
+    if (ap_sub_add(parser, names[400 + i], &sub) ||
+        ap_opt(sub, 0, names[400 + i]))
+      return AP_ERR_NOMEM;
+    ap_type_flag(sub, flags + 400 + i);
+  }
+  return ap_compile(parser);
+}
+
+TEST(arena_alloc_count) {
+  ap_ctxcb cb = {0};
+  struct allocs heap = {0}, arena = {0};
+  static int flags[500];
+  static char names[500][16];
+  const char *const argv[] = {"--option-7", "command-99", "--command-99"};
+  ap *parser = NULL;
+  cb.alloc = counting_alloc_cb;
+  cb.uptr = &heap;
+  ASSERT(!ap_init_full(&parser, "test", &cb));
+  ASSERT(!build_big_cli(parser, flags, names));
+  ap_destroy(parser);
+  cb.uptr = &arena;
+  ASSERT(!ap_init_arena(&parser, "test", &cb));
+  ASSERT(!build_big_cli(parser, flags, names));
+  ASSERT(!ap_parse(parser, 3, argv));
+  ASSERT_EQ(flags[7], 1);
+  ASSERT_EQ(flags[499], 1);
+  ap_destroy(parser);
+  ASSERT_EQ(heap.live, 0);
+  ASSERT_EQ(arena.live, 0);
+  ASSERT_GT(heap.calls, 600);
+  ASSERT_LT(arena.calls, 10);
+  PASS();
+}
+
 struct bufs {
   char out[2048];
   char err[2048];
+  int prints; /* number of calls to the print callback */
 };
 
 int dummy_print_cb(void *uptr, int fd, const char *text, size_t n) {
   if (uptr) {
+    ((struct bufs *)uptr)->prints++;
     if (fd == AP_FD_OUT)
       strncat(((struct bufs *)uptr)->out, text, n);
     else
@@ -246,6 +610,144 @@ done:
   PASS();
 }
 
+TEST(help_buffered) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int flags[10], i;
+  static char names[10][8];
+  if (!parser)
+    goto done;
+  for (i = 0; i < 10; i++) {
+    sprintf(names[i], "opt-%i", i);
+    if (ap_opt(parser, (char)('a' + i), names[i]))
+      goto done;
+    ap_type_flag(parser, flags + i);
+    ap_help(parser, "an option");
+  }
+  ASSERT(!ap_show_help(parser));
+  ASSERT_EQ(b.prints, 1);
+  ASSERT(strstr(b.out, "--opt-9\n    an option\n"));
+  b.prints = 0;
+  ASSERT_EQ(ap_error(parser, "oops"), 1);
+  ASSERT_EQ(b.prints, 1);
+  ASSERT(strstr(b.err, "abc: error: oops\n"));
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(help_cached) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int flag;
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'o', "opt"))
+    goto done;
+  ap_type_flag(parser, &flag);
+  ap_help(parser, "first");
+  ASSERT(!ap_show_help(parser));
+  ASSERT(!ap_show_help(parser));
+  ASSERT_EQ(b.prints, 2);
+  ASSERT(strstr(b.out, "first"));
+  /* mutations invalidate the cached text */
+  b.out[0] = '\0';
+  ap_help(parser, "second");
+  ap_description(parser, "description");
+  ASSERT(!ap_show_help(parser));
+  ASSERT(strstr(b.out, "second") && strstr(b.out, "description"));
+  b.out[0] = '\0';
+  if (ap_opt(parser, 'x', NULL))
+    goto done;
+  ap_type_flag(parser, &flag);
+  ASSERT(!ap_show_usage(parser));
+  ASSERT(!strcmp(b.out, "usage: abc [-ox]"));
+  /* compiling renders the text up front */
+  ASSERT(!ap_compile(parser));
+  b.out[0] = '\0';
+  b.prints = 0;
+  ASSERT(!ap_show_usage(parser));
+  ASSERT(!strcmp(b.out, "usage: abc [-ox]"));
+  ASSERT_EQ(b.prints, 1);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(render_buffer) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int flag;
+  char buf[64];
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'o', "opt"))
+    goto done;
+  ap_type_flag(parser, &flag);
+  ap_help(parser, "option");
+  ASSERT_EQ(ap_render_usage(parser, NULL, 0), 15);
+  ASSERT_EQ(ap_render_usage(parser, buf, sizeof(buf)), 15);
+  ASSERT(!strcmp(buf, "usage: abc [-o]"));
+  /* truncated like snprintf */
+  ASSERT_EQ(ap_render_usage(parser, buf, 6), 15);
+  ASSERT(!strcmp(buf, "usage"));
+  ASSERT_EQ(ap_render_help(parser, buf, sizeof(buf)), 59);
+  ASSERT(!strcmp(buf, "usage: abc [-o]\n\noptional arguments:\n  -o,--opt\n"
+                      "    option\n"));
+  ASSERT_EQ(ap_render_error(parser, "oops", buf, sizeof(buf)), 33);
+  ASSERT(!strcmp(buf, "usage: abc [-o]\nabc: error: oops\n"));
+  /* nothing went through the print callback */
+  ASSERT_EQ(b.prints, 0);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(help_aligned) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int verbose;
+  const char *input, *output;
+  if (!parser)
+    goto done;
+  ap_help_width(parser, 40);
+  ap_description(parser, "a program that copies its input file somewhere");
+  if (ap_pos(parser, "input"))
+    goto done;
+  ap_type_str(parser, &input);
+  ap_help(parser, "file");
+  if (ap_opt(parser, 'v', "verbose"))
+    goto done;
+  ap_type_flag(parser, &verbose);
+  ap_help(parser, "be verbose");
+  if (ap_opt(parser, 0, "output"))
+    goto done;
+  ap_type_str(parser, &output);
+  ap_metavar(parser, "FILE");
+  ap_help(parser, "write the output to this file instead of standard output");
+  ASSERT(!ap_show_help(parser));
+  ASSERT(!strcmp(b.out, "usage: abc [-v] [--output FILE] input\n"
+                        "\n"
+                        "a program that copies its input file\n"
+                        "somewhere\n"
+                        "\n"
+                        "positional arguments:\n"
+                        "  input          file\n"
+                        "\n"
+                        "optional arguments:\n"
+                        "  -v,--verbose   be verbose\n"
+                        "  --output FILE  write the output to\n"
+                        "                 this file instead of\n"
+                        "                 standard output\n"));
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
 TEST(type_enum) {
   ap_ctxcb cb = {0};
   struct bufs b = {0};
@@ -272,6 +774,963 @@ done:
   PASS();
 }
 
+TEST(type_enum_invalid) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int flag = -1;
+  const char *enum_choices[] = {"a", "bcd", NULL};
+  const char *const argv[] = {"-e", "bc"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'e', "enum"))
+    goto done;
+  if (ap_type_enum(parser, &flag, enum_choices))
+    goto done;
+  ASSERT_EQ(ap_parse(parser, 2, argv), AP_ERR_PARSE);
+  ASSERT_EQ(flag, -1);
+  ASSERT(!strcmp(
+      b.err, "usage: abc [-e {a,bcd}]\nabc: error: argument -e,--enum: "
+             "invalid choice for argument\n"));
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_enum_ex) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int zone = -1;
+  const char *zones[] = {"us-east", "us-west", "eu-central", "EU-north",
+                         "ap-south", NULL};
+  const char *const argv_exact[] = {"--zone", "eu-NORTH"};
+  const char *const argv_prefix[] = {"--zone", "Ap"};
+  const char *const argv_ambiguous[] = {"--zone", "us-"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 0, "zone"))
+    goto done;
+  if (ap_type_enum_ex(parser, &zone, zones, AP_ENUM_ICASE | AP_ENUM_PREFIX))
+    goto done;
+  ASSERT(!ap_parse(parser, 2, argv_exact));
+  ASSERT_EQ(zone, 3);
+  ASSERT(!ap_parse(parser, 2, argv_prefix));
+  ASSERT_EQ(zone, 4);
+  ASSERT_EQ(ap_parse(parser, 2, argv_ambiguous), AP_ERR_PARSE);
+  ASSERT(strstr(b.err, "ambiguous choice"));
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_int_formats) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int num = 0, i;
+  unsigned u = 0;
+  ap_int64 big = 0;
+  static const char *const good[] = {"42", "-42", "+42", "0x2A", "0X2a",
+                                     "052", "0o52", "0b101010"};
+  static const char *const bad[] = {"", "-", "0x", "42z", "4 2", "0b102",
+                                    "089"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'n', NULL))
+    goto done;
+  ap_type_int(parser, &num);
+  if (ap_opt(parser, 'u', NULL))
+    goto done;
+  ap_type_uint(parser, &u);
+  if (ap_opt(parser, 'l', NULL))
+    goto done;
+  ap_type_int64(parser, &big);
+  for (i = 0; i < (int)(sizeof(good) / sizeof(*good)); i++) {
+    const char *argv[2];
+    argv[0] = "-n", argv[1] = good[i];
+    ASSERT(!ap_parse(parser, 2, argv));
+    ASSERT_EQ(num, good[i][0] == '-' ? -42 : 42);
+  }
+  for (i = 0; i < (int)(sizeof(bad) / sizeof(*bad)); i++) {
+    const char *argv[2];
+    argv[0] = "-n", argv[1] = bad[i];
+    b.err[0] = '\0';
+    ASSERT_EQ(ap_parse(parser, 2, argv), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "invalid integer argument"));
+  }
+  {
+    const char *const argv_min[] = {"-n", "-2147483648"};
+    const char *const argv_over[] = {"-n", "2147483648"};
+    const char *const argv_u[] = {"-u", "4294967295"};
+    const char *const argv_uneg[] = {"-u", "-1"};
+    const char *const argv_big[] = {"-l", "-0x7fffffff00000000"};
+    ASSERT(!ap_parse(parser, 2, argv_min));
+    ASSERT_EQ(num, -2147483647 - 1);
+    ASSERT_EQ(ap_parse(parser, 2, argv_over), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "integer argument out of range"));
+    ASSERT(!ap_parse(parser, 2, argv_u));
+    ASSERT_EQ(u, 4294967295u);
+    ASSERT_EQ(ap_parse(parser, 2, argv_uneg), AP_ERR_PARSE);
+    ASSERT(!ap_parse(parser, 2, argv_big));
+    ASSERT(big < 0 && -(big / 65536 / 65536) == 0x7fffffff);
+  }
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_int_range) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int port = 0, below = 0;
+  const char *const argv_ok[] = {"--port", "65535"};
+  const char *const argv_high[] = {"--port", "65536"};
+  const char *const argv_low[] = {"--port", "-1"};
+  const char *const argv_neg_zero[] = {"--port", "-0"};
+  const char *const argv_zero[] = {"--below", "0"};
+  const char *const argv_below[] = {"--below", "-0x5"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 0, "port"))
+    goto done;
+  if (ap_type_int_range(parser, &port, 1, 65535))
+    goto done;
+  if (ap_opt(parser, 0, "below"))
+    goto done;
+  if (ap_type_int_range(parser, &below, -10, -5))
+    goto done;
+  /* zero is outside both ranges, whatever its sign */
+  ASSERT_EQ(ap_parse(parser, 2, argv_neg_zero), AP_ERR_PARSE);
+  ASSERT_EQ(ap_parse(parser, 2, argv_zero), AP_ERR_PARSE);
+  ASSERT(!ap_parse(parser, 2, argv_below));
+  ASSERT_EQ(below, -5);
+  ASSERT(!ap_parse(parser, 2, argv_ok));
+  ASSERT_EQ(port, 65535);
+  ASSERT_EQ(ap_parse(parser, 2, argv_high), AP_ERR_PARSE);
+  ASSERT_EQ(ap_parse(parser, 2, argv_low), AP_ERR_PARSE);
+  ASSERT_EQ(port, 65535);
+  ASSERT(strstr(b.err, "argument --port: integer argument out of range"));
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_double) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  double d = 0;
+  float f = 0;
+  int i;
+  static const char *const good[] = {
+      "0", "-0.5", "+3.25", ".5", "1.", "0.1", "1e23", "9007199254740993",
+      "123456789012345678901234567890.5", "2.2250738585072014e-308",
+      "4.9e-324", "1.7976931348623157e308", "0.000001234e-5",
+      "1.00000000000000011102230246251565404236316680908203125000000000001"};
+  static const char *const bad[] = {"", ".", "1e", "1e+", "1.5x", "--1",
+                                    "0x10", "1,5"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'd', NULL))
+    goto done;
+  ap_type_double(parser, &d);
+  if (ap_opt(parser, 'f', NULL))
+    goto done;
+  ap_type_float(parser, &f);
+  for (i = 0; i < (int)(sizeof(good) / sizeof(*good)); i++) {
+    const char *argv[2];
+    argv[0] = "-d", argv[1] = good[i];
+    ASSERT(!ap_parse(parser, 2, argv));
+    ASSERT(d == strtod(good[i], NULL));
+  }
+  for (i = 0; i < (int)(sizeof(bad) / sizeof(*bad)); i++) {
+    const char *argv[2];
+    argv[0] = "-d", argv[1] = bad[i];
+    b.err[0] = '\0';
+    ASSERT_EQ(ap_parse(parser, 2, argv), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "invalid number argument"));
+  }
+  {
+    const char *const argv_huge[] = {"-d", "1e400"};
+    const char *const argv_f[] = {"-f", "0.1"};
+    const char *const argv_fhuge[] = {"-f", "1e39"};
+    ASSERT_EQ(ap_parse(parser, 2, argv_huge), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "number argument out of range"));
+    ASSERT(!ap_parse(parser, 2, argv_f));
+    ASSERT(f == 0.1f);
+    ASSERT_EQ(ap_parse(parser, 2, argv_fhuge), AP_ERR_PARSE);
+  }
+  {
+    /* floats are rounded once, straight from the decimal */
+    static const char *const f_good[] = {
+        "3.4028235e38", "3.4028235677973366e38", "1.000000059604644775390625",
+        "1.0000000596046447753906250009", "1.4e-45", "7.1e-46"};
+    const float f_want[] = {FLT_MAX, FLT_MAX, 1.0f, 1.0f + FLT_EPSILON,
+                            FLT_MIN * FLT_EPSILON, FLT_MIN * FLT_EPSILON};
+    static const char *const f_huge[] = {"3.4028235677973367e38",
+                                         "-3.4028236e38"};
+    for (i = 0; i < (int)(sizeof(f_good) / sizeof(*f_good)); i++) {
+      const char *argv[2];
+      argv[0] = "-f", argv[1] = f_good[i];
+      ASSERT(!ap_parse(parser, 2, argv));
+      ASSERT(f == f_want[i]);
+    }
+    for (i = 0; i < (int)(sizeof(f_huge) / sizeof(*f_huge)); i++) {
+      const char *argv[2];
+      argv[0] = "-f", argv[1] = f_huge[i];
+      b.err[0] = '\0';
+      ASSERT_EQ(ap_parse(parser, 2, argv), AP_ERR_PARSE);
+      ASSERT(strstr(b.err, "number argument out of range"));
+    }
+  }
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_units) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  ap_uint64 size = 0, duration = 0, rate = 0;
+  int i;
+  static const struct {
+    const char *opt, *arg;
+    unsigned long value;
+  } good[] = {{"--cache", "512MiB", 536870912UL},
+              {"--cache", "1.5G", 1500000000UL},
+              {"--cache", "4k", 4000},
+              {"--cache", "4KiB", 4096},
+              {"--cache", "10", 10},
+              {"--cache", "2b", 2},
+              {"--timeout", "250ms", 250000000UL},
+              {"--timeout", "2", 2000000000UL},
+              {"--timeout", "10us", 10000},
+              {"--timeout", "0.5ns", 0},
+              {"--rate", "10k/s", 10000},
+              {"--rate", "2Mi", 2097152UL}};
+  static const char *const bad[][2] = {
+      {"--cache", "MiB"},  {"--cache", "5XB"},    {"--cache", "1.2.3"},
+      {"--cache", "5 MiB"}, {"--timeout", "5x"}, {"--timeout", "ms"},
+      {"--rate", "10k/m"}};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 0, "cache"))
+    goto done;
+  ap_type_size(parser, &size);
+  if (ap_opt(parser, 0, "timeout"))
+    goto done;
+  ap_type_duration(parser, &duration);
+  if (ap_opt(parser, 0, "rate"))
+    goto done;
+  ap_type_rate(parser, &rate);
+  ap_render_usage(parser, b.out, sizeof(b.out));
+  ASSERT(!strcmp(b.out, "usage: abc [--cache SIZE] [--timeout DURATION] "
+                        "[--rate RATE]"));
+  for (i = 0; i < (int)(sizeof(good) / sizeof(*good)); i++) {
+    const char *argv[2];
+    argv[0] = good[i].opt, argv[1] = good[i].arg;
+    ASSERT(!ap_parse(parser, 2, argv));
+    ASSERT_EQ(argv[0][2] == 'c'   ? size
+              : argv[0][2] == 't' ? duration
+                                  : rate,
+              good[i].value);
+  }
+  for (i = 0; i < (int)(sizeof(bad) / sizeof(*bad)); i++)
+    ASSERT_EQ(ap_parse(parser, 2, bad[i]), AP_ERR_PARSE);
+  {
+    const char *const argv_ok[] = {"--cache", "17E"};
+    const char *const argv_over[] = {"--cache", "16EiB"};
+    ASSERT(!ap_parse(parser, 2, argv_ok));
+    ASSERT_EQ(ap_parse(parser, 2, argv_over), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "size argument out of range"));
+  }
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_lists) {
+  int mode;
+  /* once with heap-allocated lists, once with arena-allocated lists */
+  for (mode = 0; mode < 2; mode++) {
+    ap *parser = NULL;
+    ap_str_list dirs;
+    ap_int_list nums;
+    ap_double_list xs;
+    const char *argv[206];
+    int i;
+    static const char *const args[] = {"-I", "a", "-n", "1", "-I",  "b",
+                                       "-n", "0x2", "-x", "0.5"};
+    memcpy(argv, args, sizeof(args));
+    for (i = 10; i < 206; i += 2)
+      argv[i] = "-n", argv[i + 1] = "7";
+    if ((mode ? ap_init_arena : ap_init_full)(&parser, "test", NULL))
+      goto done;
+    if (ap_opt(parser, 'I', NULL))
+      goto done;
+    ap_type_str_list(parser, &dirs);
+    if (ap_opt(parser, 'n', NULL))
+      goto done;
+    ap_type_int_list(parser, &nums);
+    if (ap_opt(parser, 'x', NULL))
+      goto done;
+    ap_type_double_list(parser, &xs);
+    ASSERT(!ap_parse(parser, 206, argv));
+    ASSERT_EQ(dirs.len, 2);
+    ASSERT(!strcmp(dirs.items[0], "a") && !strcmp(dirs.items[1], "b"));
+    ASSERT_EQ(nums.len, 100);
+    ASSERT_EQ(nums.items[0], 1);
+    ASSERT_EQ(nums.items[1], 2);
+    ASSERT_EQ(nums.items[99], 7);
+    ASSERT(nums.cap >= nums.len);
+    ASSERT_EQ(xs.len, 1);
+    ASSERT(xs.items[0] == 0.5);
+  done:
+    if (parser)
+      ap_destroy(parser);
+  }
+  PASS();
+}
+
+TEST(type_int_split) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  ap_int_list ids = {0}, fixed = {0};
+  int storage[4], i;
+  static char many[8192];
+  static const char *const bad[] = {"", "1,,2", "1,", ",1", "a", "1;2",
+                                    "1,-", "2147483648", "-2147483649"};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 0, "ids"))
+    goto done;
+  if (ap_type_int_split(parser, &ids, ','))
+    goto done;
+  fixed.items = storage, fixed.cap = 4;
+  if (ap_opt(parser, 0, "four"))
+    goto done;
+  if (ap_type_int_split(parser, &fixed, ','))
+    goto done;
+  {
+    const char *const argv[] = {
+        "--ids", "17,42,-99,0,+5,000000000012,2147483647,-2147483648"};
+    ASSERT(!ap_parse(parser, 2, argv));
+    ASSERT_EQ(ids.len, 8);
+    ASSERT_EQ(ids.items[0], 17);
+    ASSERT_EQ(ids.items[2], -99);
+    ASSERT_EQ(ids.items[4], 5);
+    ASSERT_EQ(ids.items[5], 12);
+    ASSERT_EQ(ids.items[6], 2147483647);
+    ASSERT_EQ(ids.items[7], -2147483647 - 1);
+  }
+  {
+    /* numbers of every length, at every alignment */
+    const char *argv[2];
+    char *p = many;
+    srand(1);
+    for (i = 0; i < 500; i++)
+      p += sprintf(p, i ? ",%i" : "%i", (rand() >> (i % 31)) * (i % 3 - 1));
+    argv[0] = "--ids", argv[1] = many;
+    ids.len = 0;
+    ASSERT(!ap_parse(parser, 2, argv));
+    ASSERT_EQ(ids.len, 500);
+    srand(1);
+    for (i = 0; i < 500; i++)
+      ASSERT_EQ(ids.items[i], (rand() >> (i % 31)) * (i % 3 - 1));
+  }
+  for (i = 0; i < (int)(sizeof(bad) / sizeof(*bad)); i++) {
+    const char *argv[2];
+    argv[0] = "--ids", argv[1] = bad[i];
+    ASSERT_EQ(ap_parse(parser, 2, argv), AP_ERR_PARSE);
+    /* a bad value keeps the ones before it out of the list, too */
+    ASSERT_EQ(ids.len, 500);
+  }
+  {
+    const char *const argv_partial[] = {"--ids", "1,2,x"};
+    ids.len = 0;
+    ASSERT_EQ(ap_parse(parser, 2, argv_partial), AP_ERR_PARSE);
+    ASSERT_EQ(ids.len, 0);
+  }
+  {
+    const char *const argv_fits[] = {"--four", "1,2,3,4"};
+    const char *const argv_over[] = {"--four", "5"};
+    ASSERT(!ap_parse(parser, 2, argv_fits));
+    ASSERT_EQ(fixed.len, 4);
+    ASSERT(fixed.items == storage && storage[3] == 4);
+    ASSERT_EQ(ap_parse(parser, 2, argv_over), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "too many values"));
+  }
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_flag_bit) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b), *sub;
+  unsigned long words[AP_FLAG_WORDS(80)] = {0};
+  char usage[128];
+  int i, cmd;
+  if (!parser)
+    goto done;
+  for (i = 0; i < 8; i++) {
+    if (ap_opt(parser, (char)('a' + i), NULL))
+      goto done;
+    ap_type_flag_bit(parser, words, i);
+  }
+  if (ap_opt(parser, 0, "verbose"))
+    goto done;
+  ap_type_flag_bit(parser, words, 79);
+  if (ap_pos(parser, "cmd"))
+    goto done;
+  ap_type_sub(parser, "cmd", &cmd);
+  if (ap_sub_add(parser, "run", &sub) || ap_opt(sub, 'z', NULL))
+    goto done;
+  ap_type_flag_bit(sub, words, 40);
+  {
+    const char *const argv[] = {"-ach", "--verbose", "-b", "run", "-zc"};
+    ASSERT(!ap_parse(parser, 5, argv));
+    ASSERT_EQ(words[0] & 0xFF, 0x87);
+    ASSERT(AP_FLAG_TEST(words, 79));
+    ASSERT(AP_FLAG_TEST(words, 40));
+    ASSERT(!AP_FLAG_TEST(words, 41));
+    ASSERT_EQ(
+        words[0] & (AP_FLAG_MASK(0) | AP_FLAG_MASK(7)),
+        AP_FLAG_MASK(0) | AP_FLAG_MASK(7));
+  }
+  {
+    const char *const argv[] = {"-ax"};
+    ASSERT_EQ(ap_parse(parser, 1, argv), AP_ERR_PARSE);
+  }
+  ap_render_usage(parser, usage, sizeof(usage));
+  ASSERT(strstr(usage, "[-abcdefgh]"));
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(type_map) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  ap_map defs;
+  const ap_view *v;
+  static char keys[300][16];
+  const char *argv[600];
+  int i;
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'D', "set"))
+    goto done;
+  ap_type_map(parser, &defs);
+  {
+    const char *const argv1[] = {"-Da=1", "--set", "b.c=", "-D",
+                                 "x=y=z", "-Da=3"};
+    ASSERT(!ap_parse(parser, 6, argv1));
+    ASSERT_EQ(defs.len, 3);
+    ASSERT((v = ap_map_get(&defs, "a", 1)));
+    ASSERT(v->len == 1 && v->ptr == argv1[5] + 4);
+    ASSERT((v = ap_map_get(&defs, "b.c=", 3)));
+    ASSERT_EQ(v->len, 0);
+    ASSERT((v = ap_map_get(&defs, "x", 1)));
+    ASSERT(v->len == 3 && !memcmp(v->ptr, "y=z", 3));
+    ASSERT(!ap_map_get(&defs, "b", 1));
+    ASSERT(!ap_map_get(&defs, "y", 1));
+    /* entries stay in order of first appearance */
+    ASSERT(defs.items[0].key.ptr == argv1[0] + 2);
+    ASSERT(defs.items[2].key.len == 1 && *defs.items[2].key.ptr == 'x');
+  }
+  /* enough keys to grow the table several times */
+  for (i = 0; i < 300; i++) {
+    sprintf(keys[i], "key%i=%i", i, i * 7);
+    argv[i * 2] = "-D", argv[i * 2 + 1] = keys[i];
+  }
+  ASSERT(!ap_parse(parser, 600, argv));
+  ASSERT_EQ(defs.len, 303);
+  for (i = 0; i < 300; i++) {
+    char key[16], val[16];
+    sprintf(key, "key%i", i), sprintf(val, "%i", i * 7);
+    ASSERT((v = ap_map_get(&defs, key, strlen(key))));
+    ASSERT(v->len == strlen(val) && !memcmp(v->ptr, val, v->len));
+  }
+  {
+    const char *const argv1[] = {"-D", "novalue"};
+    const char *const argv2[] = {"-D=v"};
+    ASSERT_EQ(ap_parse(parser, 2, argv1), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "expected KEY=VALUE"));
+    ASSERT_EQ(ap_parse(parser, 1, argv2), AP_ERR_PARSE);
+  }
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+/* counts how many times it's called, taking no value */
+int count_cb(void *uptr, ap_cb_data *pdata) {
+  (void)pdata;
+  ++*(int *)uptr;
+  return 0;
+}
+
+TEST(opt_long_attached_value) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  int flag = 0, num = 0, count = 0;
+  const char *out = NULL, *pos = NULL;
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'v', "verbose"))
+    goto done;
+  ap_type_flag(parser, &flag);
+  if (ap_opt(parser, 'n', "num"))
+    goto done;
+  ap_type_int(parser, &num);
+  if (ap_opt(parser, 'o', "output"))
+    goto done;
+  ap_type_str(parser, &out);
+  if (ap_opt(parser, 'h', "help"))
+    goto done;
+  ap_type_help(parser);
+  if (ap_opt(parser, 0, "count"))
+    goto done;
+  ap_type_custom(parser, count_cb, &count);
+  ap_custom_novalue(parser, 1);
+  if (ap_pos(parser, "file"))
+    goto done;
+  ap_type_str(parser, &pos);
+  {
+    const char *const argv[] = {"--num=-12", "--output=a=b", "x"};
+    ASSERT(!ap_parse(parser, 3, argv));
+    ASSERT_EQ(num, -12);
+    /* the value points into the argument itself */
+    ASSERT(out == argv[1] + 9);
+    ASSERT(pos == argv[2]);
+  }
+  {
+    /* an empty value is still a value */
+    const char *const argv[] = {"--output=", "y", "-ofile"};
+    ASSERT(!ap_parse(parser, 3, argv));
+    ASSERT(out == argv[2] + 2);
+    ASSERT(pos == argv[1]);
+    ASSERT(!ap_parse(parser, 2, argv));
+    ASSERT(out && !*out);
+  }
+  {
+    const char *const argv_flag[] = {"--verbose=1"};
+    const char *const argv_name[] = {"--nu=1"};
+    const char *const argv_num[] = {"--num="};
+    ASSERT_EQ(ap_parse(parser, 1, argv_flag), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "unexpected value"));
+    ASSERT_EQ(flag, 0);
+    ASSERT_EQ(ap_parse(parser, 1, argv_name), AP_ERR_PARSE);
+    ASSERT_EQ(ap_parse(parser, 1, argv_num), AP_ERR_PARSE);
+  }
+  {
+    /* arguments without values reject one before acting on the option */
+    const char *const argv_help[] = {"--help=x"};
+    const char *const argv_count[] = {"--count=", "z"};
+    const char *const argv_count_ok[] = {"--count", "z"};
+    b.err[0] = '\0';
+    ASSERT_EQ(ap_parse(parser, 1, argv_help), AP_ERR_PARSE);
+    ASSERT(strstr(b.err, "argument -h,--help: unexpected value"));
+    ASSERT(!b.out[0]);
+    ASSERT_EQ(ap_parse(parser, 2, argv_count), AP_ERR_PARSE);
+    ASSERT_EQ(count, 0);
+    ASSERT(!ap_parse(parser, 2, argv_count_ok));
+    ASSERT_EQ(count, 1);
+  }
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+/* results of a parse in a session, written through `ap_cb_data.base` */
+struct session_result {
+  int num;
+  const char *name;
+};
+
+int session_num_cb(void *uptr, ap_cb_data *pdata) {
+  struct session_result *res = (struct session_result *)pdata->base;
+  (void)uptr;
+  if (!pdata->arg || !pdata->arg_len)
+    return ap_arg_error(pdata, "expected a number");
+  res->num = atoi(pdata->arg);
+  return pdata->arg_len;
+}
+
+int session_name_cb(void *uptr, ap_cb_data *pdata) {
+  struct session_result *res = (struct session_result *)pdata->base;
+  (void)uptr;
+  res->name = pdata->arg;
+  return pdata->arg_len;
+}
+
+TEST(session) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  ap_session *s1 = NULL, *s2 = NULL;
+  struct session_result r1 = {0}, r2 = {0};
+  char err[128];
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'n', "num"))
+    goto done;
+  ap_type_custom(parser, session_num_cb, NULL);
+  if (ap_pos(parser, "name"))
+    goto done;
+  ap_type_custom(parser, session_name_cb, NULL);
+  if (ap_compile(parser) || ap_session_begin(&s1, parser) ||
+      ap_session_begin(&s2, parser))
+    goto done;
+  ap_session_reset(s1, &r1);
+  ap_session_reset(s2, &r2);
+  {
+    /* two sessions on one parser, each with its own results */
+    const char *const argv1[] = {"-n", "5", "first"};
+    const char *const argv2[] = {"--num=7", "second"};
+    ASSERT(!ap_session_parse(s1, 3, argv1));
+    ASSERT(!ap_session_parse(s2, 2, argv2));
+    ASSERT(r1.num == 5 && r1.name == argv1[2]);
+    ASSERT(r2.num == 7 && r2.name == argv2[1]);
+    ASSERT_EQ(ap_session_error(s1, err, sizeof(err)), 0);
+  }
+  {
+    /* errors are kept in the session instead of printed */
+    const char *const argv_num[] = {"x", "-n"};
+    const char *const argv_pos[] = {"-n1"};
+    size_t len;
+    ASSERT_EQ(ap_session_parse(s1, 2, argv_num), AP_ERR_PARSE);
+    ASSERT_EQ(ap_session_parse(s2, 1, argv_pos), AP_ERR_PARSE);
+    ASSERT_EQ(b.prints, 0);
+    len = ap_session_error(s1, NULL, 0);
+    ASSERT_EQ(ap_session_error(s1, err, sizeof(err)), len);
+    ASSERT(
+        !strcmp(err, "usage: abc [-n] name\n"
+                     "abc: error: argument -n,--num: expected a number\n"));
+    ap_session_error(s2, err, sizeof(err));
+    ASSERT(strstr(err, "argument name: expected an argument"));
+    ASSERT(r2.num == 1);
+  }
+  {
+    const char *const argv[] = {"third"};
+    ap_session_reset(s2, &r1);
+    ASSERT(!ap_session_parse(s2, 1, argv));
+    ASSERT(r1.name == argv[0]);
+    ASSERT_EQ(ap_session_error(s2, err, sizeof(err)), 0);
+  }
+done:
+  if (s1)
+    ap_session_end(s1);
+  if (s2)
+    ap_session_end(s2);
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(session_sub_error) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  ap_session *sess = NULL;
+  int out_idx = -1, verbose = 0;
+  char err[128];
+  const char *const argv[] = {"run", "-v", "zz"};
+  if (!parser)
+    goto done;
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub(parser, "command", &out_idx);
+  {
+    ap *sub;
+    if (ap_sub_add(parser, "run", &sub))
+      goto done;
+    if (ap_opt(sub, 'v', NULL))
+      goto done;
+    ap_type_int(sub, &verbose);
+  }
+  if (ap_compile(parser) || ap_session_begin(&sess, parser))
+    goto done;
+  /* errors inside a subcommand are reported under the program's name */
+  ASSERT_EQ(ap_session_parse(sess, 3, argv), AP_ERR_PARSE);
+  ASSERT_EQ(b.prints, 0);
+  ap_session_error(sess, err, sizeof(err));
+  ASSERT(!strncmp(err, "usage: abc", 10));
+  ASSERT(strstr(err, "\nabc: error: argument -v: "));
+  ASSERT_EQ(ap_parse(parser, 3, argv), AP_ERR_PARSE);
+  ASSERT(strstr(b.err, "abc: error: argument -v: "));
+done:
+  if (sess)
+    ap_session_end(sess);
+  ap_destroy(parser);
+  PASS();
+}
+
+/* a struct that parsers bound to offsets fill */
+struct bound_cfg {
+  int verbose;
+  unsigned long bits[1];
+  int threads;
+  double ratio;
+  ap_uint64 cache;
+  const char *name;
+  int level;
+  int mode;
+  int cmd;
+};
+
+TEST(bind_offsets) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  ap_session *sess = NULL;
+  struct bound_cfg cfgs[3];
+  static const char *const cmds[3][5] = {
+      {"-v", "--threads=4", "first", "-l3", NULL},
+      {"-x", "--cache", "2KiB", "second", "-mslow"},
+      {"-vx", "--ratio=0.5", "-t9", "third", NULL}};
+  static const int cmd_argc[3] = {4, 5, 4};
+  static const char *modes[] = {"fast", "slow", NULL};
+  int i;
+  if (!parser)
+    goto done;
+  memset(cfgs, 0, sizeof(cfgs));
+  if (ap_opt(parser, 'v', NULL))
+    goto done;
+  ap_type_flag_at(parser, offsetof(struct bound_cfg, verbose));
+  if (ap_opt(parser, 'x', NULL))
+    goto done;
+  ap_type_flag_bit_at(parser, offsetof(struct bound_cfg, bits), 3);
+  if (ap_opt(parser, 't', "threads"))
+    goto done;
+  ap_type_int_at(parser, offsetof(struct bound_cfg, threads));
+  if (ap_opt(parser, 0, "ratio"))
+    goto done;
+  ap_type_double_at(parser, offsetof(struct bound_cfg, ratio));
+  if (ap_opt(parser, 0, "cache"))
+    goto done;
+  ap_type_size_at(parser, offsetof(struct bound_cfg, cache));
+  if (ap_pos(parser, "name"))
+    goto done;
+  ap_type_str_at(parser, offsetof(struct bound_cfg, name));
+  if (ap_opt(parser, 'l', NULL) ||
+      ap_type_int_range_at(parser, offsetof(struct bound_cfg, level), 0, 9))
+    goto done;
+  if (ap_opt(parser, 'm', NULL) ||
+      ap_type_enum_at(parser, offsetof(struct bound_cfg, mode), modes, 0))
+    goto done;
+  /* one parser definition fills every struct */
+  for (i = 0; i < 3; i++)
+    ASSERT(!ap_parse_into(parser, cfgs + i, cmd_argc[i], cmds[i]));
+  ASSERT(cfgs[0].verbose == 1 && cfgs[0].threads == 4 && !cfgs[0].bits[0]);
+  ASSERT(cfgs[0].name == cmds[0][2] && cfgs[0].level == 3);
+  ASSERT(!cfgs[0].mode && cfgs[1].mode == 1 && !cfgs[1].level);
+  ASSERT(!cfgs[1].verbose && cfgs[1].bits[0] == AP_FLAG_MASK(3));
+  ASSERT(cfgs[1].cache == 2048 && cfgs[1].name == cmds[1][3]);
+  ASSERT(cfgs[2].verbose && cfgs[2].bits[0] && cfgs[2].threads == 9);
+  ASSERT(cfgs[2].ratio == 0.5 && !cfgs[2].cache);
+  /* and works the same in sessions */
+  memset(cfgs, 0, sizeof(cfgs));
+  if (ap_compile(parser) || ap_session_begin(&sess, parser))
+    goto done;
+  for (i = 2; i >= 0; i--) {
+    ap_session_reset(sess, cfgs + i);
+    ASSERT(!ap_session_parse(sess, cmd_argc[i], cmds[i]));
+  }
+  ASSERT(cfgs[0].threads == 4 && cfgs[1].cache == 2048);
+  ASSERT(cfgs[2].threads == 9 && cfgs[2].name == cmds[2][3]);
+  ASSERT(cfgs[0].level == 3 && cfgs[1].mode == 1);
+done:
+  if (sess)
+    ap_session_end(sess);
+  ap_destroy(parser);
+  PASS();
+}
+
+TEST(bind_offsets_sub) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  struct bound_cfg cfgs[2];
+  static const char *const argv_run[] = {"run", "-t2"};
+  static const char *const argv_stop[] = {"-v", "stop"};
+  ap *sub;
+  if (!parser)
+    goto done;
+  memset(cfgs, 0, sizeof(cfgs));
+  if (ap_opt(parser, 'v', NULL))
+    goto done;
+  ap_type_flag_at(parser, offsetof(struct bound_cfg, verbose));
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub_at(parser, "command", offsetof(struct bound_cfg, cmd));
+  if (ap_sub_add(parser, "stop", &sub) || ap_sub_add(parser, "run", &sub))
+    goto done;
+  /* subparsers fill the same struct */
+  if (ap_opt(sub, 't', NULL))
+    goto done;
+  ap_type_int_at(sub, offsetof(struct bound_cfg, threads));
+  ASSERT(!ap_parse_into(parser, cfgs, 2, argv_run));
+  ASSERT(!ap_parse_into(parser, cfgs + 1, 2, argv_stop));
+  ASSERT(cfgs[0].cmd == 1 && cfgs[0].threads == 2 && !cfgs[0].verbose);
+  ASSERT(cfgs[1].cmd == 0 && !cfgs[1].threads && cfgs[1].verbose);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+/* runs batch jobs one after another, last first, counting them */
+void reverse_runner(void *uptr, int njobs, ap_batch_job job, void *arg) {
+  *(int *)uptr = njobs;
+  while (njobs--)
+    job(arg, njobs);
+}
+
+TEST(parse_batch) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  static const char *const ok1[] = {"-t3", "a"}, *const ok2[] = {"b"};
+  static const char *const bad1[] = {"-t"}, *const bad2[] = {"-q", "c"};
+  static const char *const *const argvs[] = {ok1, bad1, ok2, bad2, ok1};
+  static const int argcs[] = {2, 1, 1, 2, 2};
+  ap_cmdline cmds[5];
+  struct bound_cfg cfgs[5];
+  int status[5], i, mode, njobs = 0;
+  ap_batch batch = {0};
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 't', "threads"))
+    goto done;
+  ap_type_int_at(parser, offsetof(struct bound_cfg, threads));
+  if (ap_pos(parser, "name"))
+    goto done;
+  ap_type_str_at(parser, offsetof(struct bound_cfg, name));
+  if (ap_compile(parser))
+    goto done;
+  for (i = 0; i < 5; i++)
+    cmds[i].argc = argcs[i], cmds[i].argv = argvs[i];
+  batch.cmds = cmds, batch.n = 5;
+  batch.results = cfgs, batch.result_size = sizeof(*cfgs);
+  batch.status = status;
+  for (mode = 0; mode < 3; mode++) {
+    /* on this thread, then with a runner and 2 workers, then with more
+     * workers than command lines */
+    batch.nworkers = mode * 4;
+    batch.runner = mode ? reverse_runner : NULL;
+    batch.runner_uptr = &njobs;
+    memset(cfgs, 0, sizeof(cfgs));
+    ASSERT_EQ(ap_parse_batch(parser, &batch), 2);
+    ASSERT_EQ(njobs, mode == 1 ? 4 : mode == 2 ? 5 : 0);
+    ASSERT(!status[0] && !status[2] && !status[4]);
+    ASSERT_EQ(status[1], AP_ERR_PARSE);
+    ASSERT_EQ(status[3], AP_ERR_PARSE);
+    ASSERT(cfgs[0].threads == 3 && cfgs[0].name == ok1[1]);
+    ASSERT(!cfgs[2].threads && cfgs[2].name == ok2[0]);
+    ASSERT(cfgs[4].threads == 3 && cfgs[4].name == ok1[1]);
+  }
+  ASSERT_EQ(b.prints, 0);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
+#define THREAD_JOBS 4
+
+struct thread_job {
+  ap_batch_job job;
+  void *arg;
+  int i;
+};
+
+void *thread_job_main(void *uptr) {
+  struct thread_job *t = (struct thread_job *)uptr;
+  t->job(t->arg, t->i);
+  return NULL;
+}
+
+/* runs every batch job on its own thread */
+void thread_runner(void *uptr, int njobs, ap_batch_job job, void *arg) {
+  pthread_t threads[THREAD_JOBS];
+  struct thread_job jobs[THREAD_JOBS];
+  int started[THREAD_JOBS], i;
+  (void)uptr;
+  for (i = 0; i < njobs && i < THREAD_JOBS; i++) {
+    jobs[i].job = job, jobs[i].arg = arg, jobs[i].i = i;
+    started[i] = !pthread_create(threads + i, NULL, thread_job_main, jobs + i);
+    if (!started[i])
+      job(arg, i);
+  }
+  for (i = 0; i < njobs && i < THREAD_JOBS; i++)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+}
+
+TEST(parse_batch_threads) {
+  ap_ctxcb cb = {0};
+  struct bufs b = {0};
+  ap *parser = make_out_hooks(&cb, &b);
+  static const char *const run[] = {"run", "-t", "7"};
+  static const char *const stop[] = {"-v", "stop"};
+  static const char *const bad[] = {"run", "-t", "x"};
+  static const char *const help[] = {"run", "-h"};
+  static const char *const *const argvs[] = {run, stop, bad, help};
+  static const int argcs[] = {3, 2, 3, 2};
+  ap_cmdline cmds[64];
+  struct bound_cfg cfgs[64];
+  int status[64], i, rep;
+  ap_batch batch = {0};
+  ap *sub;
+  if (!parser)
+    goto done;
+  if (ap_opt(parser, 'v', NULL))
+    goto done;
+  ap_type_flag_at(parser, offsetof(struct bound_cfg, verbose));
+  if (ap_opt(parser, 'h', NULL))
+    goto done;
+  ap_type_help(parser);
+  if (ap_pos(parser, "command"))
+    goto done;
+  ap_type_sub_at(parser, "command", offsetof(struct bound_cfg, cmd));
+  if (ap_sub_add(parser, "stop", &sub) || ap_sub_add(parser, "run", &sub))
+    goto done;
+  if (ap_opt(sub, 't', NULL))
+    goto done;
+  ap_type_int_at(sub, offsetof(struct bound_cfg, threads));
+  if (ap_compile(parser))
+    goto done;
+  for (i = 0; i < 64; i++)
+    cmds[i].argc = argcs[i % 4], cmds[i].argv = argvs[i % 4];
+  batch.cmds = cmds, batch.n = 64;
+  batch.results = cfgs, batch.result_size = sizeof(*cfgs);
+  batch.status = status;
+  batch.nworkers = THREAD_JOBS;
+  batch.runner = thread_runner;
+  for (rep = 0; rep < 20; rep++) {
+    /* every record says which subcommand it selected */
+    memset(cfgs, 0, sizeof(cfgs));
+    ASSERT_EQ(ap_parse_batch(parser, &batch), 32);
+    for (i = 0; i < 64; i += 4) {
+      ASSERT(!status[i] && cfgs[i].cmd == 1 && cfgs[i].threads == 7);
+      ASSERT(!status[i + 1] && !cfgs[i + 1].cmd && cfgs[i + 1].verbose);
+      ASSERT_EQ(status[i + 2], AP_ERR_PARSE);
+      ASSERT_EQ(status[i + 3], AP_ERR_EXIT);
+    }
+  }
+  /* help doesn't print from inside a batch */
+  ASSERT_EQ(b.prints, 0);
+done:
+  ap_destroy(parser);
+  PASS();
+}
+
 int main(int argc, const char *const *argv) {
   MPTEST_MAIN_BEGIN_ARGS(argc, argv);
   RUN_TEST(init);
@@ -281,11 +1740,42 @@ int main(int argc, const char *const *argv) {
   RUN_TEST(opt_short_only);
   RUN_TEST(opt_long_only);
   RUN_TEST(opt_long_specified);
+  RUN_TEST(opt_short_attached_value);
+  RUN_TEST(opt_long_many);
+  RUN_TEST(opt_long_added_after_parse);
   RUN_TEST(pos_specified);
+  RUN_TEST(parse_views);
   RUN_TEST(sub_empty);
+  RUN_TEST(sub_inherits_parent_opts);
+  RUN_TEST(sub_nested_long_shadowing);
+  RUN_TEST(sub_many);
+  RUN_TEST(sub_lazy);
+  RUN_TEST(compile);
+  RUN_TEST(arena_alloc_count);
   RUN_TEST(usage_empty);
   RUN_TEST(help_empty);
   RUN_TEST(help_opts);
+  RUN_TEST(help_buffered);
+  RUN_TEST(help_cached);
+  RUN_TEST(render_buffer);
+  RUN_TEST(help_aligned);
   RUN_TEST(type_enum);
+  RUN_TEST(type_enum_invalid);
+  RUN_TEST(type_enum_ex);
+  RUN_TEST(type_int_formats);
+  RUN_TEST(type_int_range);
+  RUN_TEST(type_double);
+  RUN_TEST(type_units);
+  RUN_TEST(type_lists);
+  RUN_TEST(type_int_split);
+  RUN_TEST(type_flag_bit);
+  RUN_TEST(type_map);
+  RUN_TEST(opt_long_attached_value);
+  RUN_TEST(session);
+  RUN_TEST(session_sub_error);
+  RUN_TEST(bind_offsets);
+  RUN_TEST(bind_offsets_sub);
+  RUN_TEST(parse_batch);
+  RUN_TEST(parse_batch_threads);
   MPTEST_MAIN_END();
 }